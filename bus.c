@@ -1,7 +1,9 @@
+#include <stddef.h>
 #include <string.h>
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "hardware/xip_cache.h"
+#include "hardware/timer.h"
 
 #include "debug.h"
 #include "bus.h"
@@ -10,71 +12,992 @@
 
 #include "shared/romlist.h"
 
+#ifdef BUS_PIO
+#include "hardware/pio.h"
+#include "bus.pio.h"
+#endif
+
+#include "hardware/dma.h"
+
+#ifdef BUS_DMA
+#if !defined(BUS_PIO) || !defined(LOAD_BANKS_16K)
+#error "BUS_DMA needs BUS_PIO and LOAD_BANKS_16K"
+#endif
+#endif
+
+#if defined(LAZY_LOAD) && !defined(LOAD_PAGED)
+#error "LAZY_LOAD needs LOAD_PAGED"
+#endif
+
+#if defined(LOAD_DMA) && !defined(LOAD_BANKS_16K) && !defined(LOAD_BANKS_4K)
+#error "LOAD_DMA needs LOAD_BANKS_16K or LOAD_BANKS_4K"
+#endif
+
+#if defined(SAVE_BACKGROUND) && (!defined(BUS_CORE1) || defined(NO_LOAD) || defined(LOAD_PAGED))
+// The bus loop keeps running while flash is written: it must not read rom from flash. Nor from pinned cache
+// lines, which the cache flush of flash operations unpins: those banks are left out of the rom.
+#error "SAVE_BACKGROUND needs BUS_CORE1, with LOAD_NO_BANKS, LOAD_BANKS_16K or LOAD_BANKS_4K"
+#endif
+
+#if defined(AUTOSAVE) && !defined(SAVE_BACKGROUND)
+#error "AUTOSAVE needs SAVE_BACKGROUND"
+#endif
+
+#if defined(EARLY_DECODE) && defined(BUS_PIO)
+// The state machines only push the address once /RD is low
+#error "EARLY_DECODE needs the SIO front-end (no BUS_PIO)"
+#endif
+
 
 #define CACHE_AS_SRAM_OFFSET 0x02000000
 
+// Each backend maps window i (of 1 << ROM_WINDOW_SHIFT bytes) of 16 KiB rom bank to its storage. Cart ram
+// larger than 8 KiB is taken from the end of the same storage (RAM_POOL), the rom then has that much less.
+#define MAX_RAM_LENGTH (128*1024)
+
 #ifdef NO_LOAD
-#define SET_DATA(data_location_in_rom) data = rom[data_location_in_rom]
+const uint8_t* rom;
+#define ROM_WINDOW_SHIFT 14
+#define ROM_BANK_WINDOW(bank, i) (rom + ((bank) << 14))
+// Rom read from flash, only the ram needs storage
+uint8_t sram_ram[MAX_RAM_LENGTH];
+#define RAM_POOL sram_ram
 #endif
 
 #ifdef LOAD_NO_BANKS
 #define ROM_MAX_LENGTH (256*1024)
 uint8_t sram_rom[ROM_MAX_LENGTH];
-#define SET_DATA(data_location_in_rom) data = sram_rom[data_location_in_rom]
+#define ROM_WINDOW_SHIFT 14
+#define ROM_BANK_WINDOW(bank, i) (sram_rom + (((bank) << 14) & (ROM_MAX_LENGTH - 1)))
+#define RAM_POOL sram_rom
 #endif
 
 #ifdef LOAD_BANKS_16K
 // 32 banks of 16 KiB (1 bank (16KiB) in pinned cache + 31 banks (496KiB) in main RAM)
 #define BANK_LENGTH (16*1024)
 #define MAX_BANKS_COUNT (32)
+#ifdef SAVE_BACKGROUND
+// Not the cache bank: 496 KiB, so 256 KiB ROMs at most (sizes are powers of two)
+#define ROM_BANKS_COUNT (31)
+#else
+#define ROM_BANKS_COUNT (32)
+#endif
 uint8_t* xip_bank31 = (uint8_t*) (XIP_BASE+CACHE_AS_SRAM_OFFSET);
+#ifdef BUS_DMA
+// ROM reads build the byte address from the bank address >> 14
+uint8_t sram_banks[31][BANK_LENGTH] __attribute__((aligned(BANK_LENGTH)));
+#else
 uint8_t sram_banks[31][BANK_LENGTH];
+#endif
 uint8_t* banks[MAX_BANKS_COUNT]; // 524288 bytes of rom data across 32 banks
-#define SET_DATA(data_location_in_rom) int bank = (data_location_in_rom >> 14) & 0x1f; int addr = data_location_in_rom & 0x3fff; data = banks[bank][addr]
+#define ROM_WINDOW_SHIFT 14
+#define ROM_BANK_WINDOW(bank, i) banks[(bank) & 0x1f]
+#define RAM_POOL sram_banks
 #endif
 
 #ifdef LOAD_BANKS_4K
 // 128 banks of 4 KiB (1 bank (4KiB) in USB RAM + 4 banks (16KiB) in pinned cache + 123 banks (492KiB) in main RAM)
 #define BANK_LENGTH (4*1024)
 #define MAX_BANKS_COUNT (128)
+#ifdef SAVE_BACKGROUND
+// Not the cache banks: 496 KiB, so 256 KiB ROMs at most (sizes are powers of two)
+#define ROM_BANKS_COUNT (124)
+#else
+#define ROM_BANKS_COUNT (128)
+#endif
 uint8_t* xip_banks = (uint8_t*) (XIP_BASE+CACHE_AS_SRAM_OFFSET);
 uint8_t* usb_bank = (uint8_t*) (USBCTRL_DPRAM_BASE);
 uint8_t sram_banks[123][BANK_LENGTH];
 uint8_t* banks[MAX_BANKS_COUNT]; // 524288 bytes of rom data across 128 banks
-#define SET_DATA(data_location_in_rom) int bank = (data_location_in_rom >> 12) & 0x7f; int addr = data_location_in_rom & 0x0fff; data = banks[bank][addr]
+#define ROM_WINDOW_SHIFT 12
+#define ROM_BANK_WINDOW(bank, i) banks[(((bank) << 2) + (i)) & 0x7f]
+#define RAM_POOL sram_banks
+#endif
+
+#ifdef LOAD_DMA
+// Banks are copied from flash by DMA: a control channel feeds the data channel one block (source, bank) at a
+// time, the sniffer computes the CRC32 of the rom on the way, checked against the one of the slot. A null
+// block ends the list. The sniffer is taken until finish_load_dma(), crc32_dma() must not run meanwhile.
+typedef struct {
+    uint32_t read_addr;
+    uint32_t write_addr;
+} load_block_t;
+load_block_t load_blocks[MAX_BANKS_COUNT + 1];
+int load_data_channel = -1;
+int load_ctrl_channel = -1;
+int load_banks_count = -1;    // Banks of the load in progress, -1 if none
+uint32_t load_crc;
+#endif
+
+#ifdef LOAD_PAGED
+// Working set of 32 banks of 16 KiB, for roms larger than 512 KiB: each slot holds a bank in 4 frames of 4 KiB
+// (same storage as LOAD_BANKS_4K). Banks are filled by DMA from the rom in flash when switched in, and read
+// from flash until then. Bank 0 stays in slot 0.
+#define FRAME_LENGTH (4*1024)
+#define FRAMES_COUNT (128)
+#define PAGED_SLOTS_COUNT (FRAMES_COUNT / 4)
+#define MAX_ROM_BANKS (512) // 8 MiB (MBC5)
+#define NO_BANK 0xffff
+uint8_t* xip_frames = (uint8_t*) (XIP_BASE+CACHE_AS_SRAM_OFFSET);
+uint8_t* usb_frame = (uint8_t*) (USBCTRL_DPRAM_BASE);
+uint8_t sram_frames[123][FRAME_LENGTH];
+uint8_t* frames[FRAMES_COUNT];
+int paged_slots;    // Slots left by the ram
+const uint8_t* paged_rom;
+uint8_t bank_slots[MAX_ROM_BANKS];          // Slot + 1 of each resident bank, 0 if not resident
+uint16_t slot_banks[PAGED_SLOTS_COUNT];     // Bank held by each slot, NO_BANK if none
+uint32_t slot_last_used[PAGED_SLOTS_COUNT];
+uint32_t paging_clock;
+uint16_t paged_current_bank;
+// Fill in progress, one frame per DMA transfer
+bool paging_busy;
+int paging_channel = -1;
+int fill_slot;
+uint16_t fill_bank;
+int fill_frame;
+#ifdef LAZY_LOAD
+// Banks not loaded before reset is released are preloaded in the background, in order, into free slots.
+// A preload gives way to a bank switched in.
+bool fill_preload;
+uint16_t preload_bank;
+uint16_t preload_end;
+#endif
+#define ROM_WINDOW_SHIFT 12
+#define ROM_BANK_WINDOW(bank, i) paged_bank_window(bank, i)
+#define RAM_POOL sram_frames
+// Once per cycle, moves the fill along
+#define ROM_PAGING_POLL() if (paging_busy) poll_paging()
+#else
+#define ROM_PAGING_POLL()
+#endif
+
+#define ROM_WINDOW_MASK ((1 << ROM_WINDOW_SHIFT) - 1)
+
+// Address space as 16 regions of 4 KiB, indexed by address >> 12. A read is a load from the base of its
+// region at the address under the region mask (0xfff, 0x1ff for the mirrored MBC2 ram, 0 for a single byte
+// such as open bus or a clock register), so every region costs the same. Bank switches and ram enables
+// update the entries.
+#define REGION_SHIFT 12
+#define REGION_MASK ((1 << REGION_SHIFT) - 1)
+#define REGIONS 16
+#define ROM_REGIONS (0x8000 >> REGION_SHIFT)
+typedef struct {
+    const uint8_t* base;
+    uint32_t mask;
+} read_region_t;
+read_region_t read_regions[REGIONS];
+static uint8_t open_bus = 0xff;    // In RAM, read by core1 while flash is written
+// 4 KiB region i of 16 KiB rom bank
+#define ROM_REGION(bank, i) \
+    (ROM_BANK_WINDOW(bank, (i) >> (ROM_WINDOW_SHIFT - REGION_SHIFT)) + (((i) << REGION_SHIFT) & ROM_WINDOW_MASK))
+
+static inline __attribute__((always_inline)) uint8_t read_region(uint32_t address) {
+    const read_region_t* region = &read_regions[address >> REGION_SHIFT];
+    return region->base[address & region->mask];
+}
+
+static inline __attribute__((always_inline)) void map_region(int i, const uint8_t* base, uint32_t mask) {
+    read_regions[i].base = base != NULL ? base : &open_bus;
+    read_regions[i].mask = base != NULL ? mask : 0;
+}
+
+// Slot header: magic (16 bytes), rom size (u32), format (u8), checksum kind (u8), padding, packed size (u32 at
+// 24, packed slots only), checksum of the stored data: CRC32 (u32 at 28) or BSD sum (u16 at 30). 0xff padding,
+// format and kind in slots from the original loadrom.sh.
+#define SLOT_HEADER_LENGTH 32
+#define SLOT_FORMAT_RAW 0xff
+#define SLOT_FORMAT_PACKED 0x01
+#define SLOT_CHECKSUM_BSD 0xff
+#define SLOT_CHECKSUM_CRC32 0x01
+// End of the cartridge header, stored as is in packed slots
+#define ROM_HEADER_END 0x150
+
+#if defined(LOAD_NO_BANKS) || defined(LOAD_BANKS_16K) || defined(LOAD_BANKS_4K)
+// Packed slots (tools/packrom.py) are decompressed into the rom windows while loading
+#define ROM_UNPACK
+#endif
+
+#ifdef BUS_PIO
+// Cycles are latched by the state machines of bus.pio, the loops only exchange FIFO words with them
+#define BUS_PIO_INSTANCE pio0
+#define BUS_SM_READ 0
+#define BUS_SM_WRITE 1
+#define BUS_SM_ROM 2
+#define BUS_WAIT_READ(address) address = pio_sm_get_blocking(BUS_PIO_INSTANCE, BUS_SM_READ)
+#define BUS_WAIT_CYCLE(writing, address) \
+    uint32_t bus_word; \
+    while (true) { \
+        if (!pio_sm_is_rx_fifo_empty(BUS_PIO_INSTANCE, BUS_SM_READ)) { \
+            bus_word = pio_sm_get(BUS_PIO_INSTANCE, BUS_SM_READ); \
+            writing = false; \
+            break; \
+        } \
+        if (!pio_sm_is_rx_fifo_empty(BUS_PIO_INSTANCE, BUS_SM_WRITE)) { \
+            bus_word = pio_sm_get(BUS_PIO_INSTANCE, BUS_SM_WRITE); \
+            writing = true; \
+            break; \
+        } \
+    } \
+    address = bus_word & GB_ADDR_PINS_MASK
+// Write words hold D0-D7 above A0-A15, as on the pins
+#define BUS_READ_DATA(data) data = (bus_word & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT
+// The read state machine drives the byte until /RD goes high
+#define BUS_DRIVE_DATA(data) pio_sm_put(BUS_PIO_INSTANCE, BUS_SM_READ, data)
+// Reads outside of the cart never reach the loops, the state machines release D0-D7 when /RD rises (bus.pio)
+#define BUS_CART_READ(address) true
+#define BUS_WAIT_END()
+#else
+// Poll the pins through SIO. The bus pins are all in GPIO 0-31, so each access is a single SIO register
+// (the 64-bit functions also access GPIO 32-47), and the sample that sees the strobe gives the address and
+// /WR. Per cycle: 1 read of the pins from strobe to address, then 3 accesses to drive a byte or 1 to read one,
+// then the end of the cycle.
+#define BUS_WAIT_READ(address) \
+    uint32_t bus_pins; \
+    while(((bus_pins = gpio_get_all()) & GB_RD_PIN_MASK) != 0) { \
+        BUS_EARLY_DECODE(bus_pins); \
+    } \
+    address = bus_pins & GB_ADDR_PINS_MASK
+#define BUS_WAIT_CYCLE(writing, address) \
+    uint32_t bus_pins; \
+    while(((bus_pins = gpio_get_all()) & GB_CTRL_PINS_MASK) == GB_CTRL_PINS_MASK) { \
+        BUS_EARLY_DECODE(bus_pins); \
+    } \
+    writing = (bus_pins & GB_WR_PIN_MASK) == 0; \
+    address = bus_pins & GB_ADDR_PINS_MASK
+// D0-D7 are already released (BUS_WAIT_END)
+#define BUS_READ_DATA(data) data = (gpio_get_all() & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT
+#define BUS_DRIVE_DATA(data) \
+    gpio_set_dir_out_masked(GB_DATA_PINS_MASK); \
+    gpio_put_masked(GB_DATA_PINS_MASK, data << GB_DATA_PINS_SHIFT)
+// Reads of the cart, as decoded by bus.pio: 0x0000-0x7fff and 0xa000-0xbfff, bit per 4 KiB region. Other
+// reads (e.g. WRAM) leave D0-D7 to the console.
+#define CART_READ_REGIONS 0x0cff
+#define BUS_CART_READ(address) (((CART_READ_REGIONS >> ((address) >> REGION_SHIFT)) & 1) != 0)
+// End of every cycle, as gb_bus_read does: D0-D7 are released once /RD (or /WR) is back high, where the
+// console has latched the byte, so each cycle starts with the data bus released whatever came before.
+// Also keeps a cycle from being handled twice.
+#define BUS_WAIT_END() \
+    while((gpio_get_all() & GB_CTRL_PINS_MASK) != GB_CTRL_PINS_MASK) { \
+        tight_loop_contents(); \
+    } \
+    gpio_set_dir_in_masked(GB_DATA_PINS_MASK)
+#endif
+
+#ifdef EARLY_DECODE
+// The console sets the address well before /RD falls: each sample of the pins taken while waiting for the
+// strobe looks the byte up again if the address lines changed since the last one. When /RD falls, the byte
+// is ready if it was looked up for the address sampled with the strobe, and looked up again otherwise.
+// Writes may remap the regions, the loops drop the byte after each one (BUS_EARLY_DROP).
+#define NO_EARLY_ADDRESS 0xffffffff
+#define BUS_EARLY_STATE() \
+    uint32_t early_address = NO_EARLY_ADDRESS; \
+    uint8_t early_data = 0xff
+#define BUS_EARLY_DECODE(pins) \
+    if (((pins) & GB_ADDR_PINS_MASK) != early_address) { \
+        early_address = (pins) & GB_ADDR_PINS_MASK; \
+        early_data = read_region(early_address); \
+    }
+#define BUS_EARLY_READ(address) ((address) == early_address ? early_data : read_region(address))
+#define BUS_EARLY_DROP() early_address = NO_EARLY_ADDRESS
+#else
+#define BUS_EARLY_STATE()
+#define BUS_EARLY_DECODE(pins) tight_loop_contents()
+#define BUS_EARLY_READ(address) read_region(address)
+#define BUS_EARLY_DROP()
+#endif
+
+#ifdef BUS_DMA
+// ROM reads never reach the loops, which only keep the switchable bank of the ROM state machine up to date
+#define BUS_SET_ROM_BANK() gb_bus_read_dma_set_bank(BUS_PIO_INSTANCE, BUS_SM_ROM, pio_x, read_regions[ROM_REGIONS/2].base)
+#else
+#define BUS_SET_ROM_BANK()
+#endif
+
+#ifdef BUS_CORE1
+// Core1 does not print from the loops: stdio runs from flash, and belongs to core0
+#define LOOP_DEBUGF(...)
+#else
+#define LOOP_DEBUGF(...) DEBUGF(__VA_ARGS__)
 #endif
 
-// FIXME Support larger ram (32 KiB) ?
-uint8_t ram[8192];
+// Cart ram: 8 KiB in its own buffer, larger ones at the end of RAM_POOL
+uint8_t ram_8k[8192];
+uint8_t* ram = ram_8k;
+uint32_t ram_reserved;      // Bytes of RAM_POOL taken by the ram
+// Flash sectors of the cart ram written since it was loaded or persisted, bit per sector. Also set while
+// the ram is persisted when the bus loop runs on the other core (SAVE_BACKGROUND).
+volatile uint32_t ram_dirty;
 
 cart_t cart;
+uint16_t rom_bank_mask;     // Bank numbers wrap around at the (power of 2) rom size
 
 roms_t my_roms;
 
 bool selecting_rom = false;
 uint8_t* selected_rom_addr;
 
+const char* magic = "pico-gb-rom     ";
+
+// Flash directory (tools/flashdir.py), in the last sector before the first 1 MiB slot. Without one, roms
+// are looked for in the fixed slots.
+#define ROM_DIR_OFFSET 0x000ff000
+#define ROM_DIR_MAGIC "pico-gb-dir     "
+#define ROMS_MAX_COUNT (sizeof(my_roms.entries) / sizeof(my_roms.entries[0]))
+#define ROM_DIR_MAX_ENTRIES ROMS_MAX_COUNT
+
+typedef struct {
+    uint32_t offset;        // Slot header and rom data, from the start of flash
+    uint32_t length;
+    uint32_t save_offset;   // Sector aligned
+    uint32_t save_length;   // 0 without save area
+} rom_dir_entry_t;
+
+typedef struct {
+    char magic[16];
+    uint32_t count;
+    uint32_t reserved[3];
+    rom_dir_entry_t entries[ROM_DIR_MAX_ENTRIES];
+} rom_dir_t;
+
+rom_dir_t rom_dir;
+uint8_t* rom_saves[ROM_DIR_MAX_ENTRIES];    // Save area of each listed rom, NULL for fixed slots
+
+// Roms checked by previous boots, in the sector below the directory: the header (after the magic) of each
+// slot and whether its checksum matched. Slots with the same header are not checksummed again. Rewritten,
+// with the next generation, when a slot changed.
+#define ROM_VERIFIED_OFFSET 0x000fe000
+#define ROM_VERIFIED_MAGIC "pico-gb-verified"
+#define ROM_VERIFIED_MAX 16     // Fixed slots or directory entries
+
+typedef struct {
+    uint32_t address;
+    uint32_t valid;
+    uint8_t header[SLOT_HEADER_LENGTH - 16];
+} rom_verified_entry_t;
+
+typedef union {
+    struct {
+        char magic[16];
+        uint32_t generation;
+        uint32_t count;
+        uint32_t reserved[2];
+        rom_verified_entry_t entries[ROM_VERIFIED_MAX];
+    };
+    uint8_t pages[2 * FLASH_PAGE_SIZE];
+} rom_verified_t;
+
+rom_verified_t rom_verified_before;
+rom_verified_t rom_verified;
+
+// Save log: a ring of sectors below the verified roms, where saves are appended as records instead of being
+// written over the previous one. A record is a header page, written last to commit it, followed by the save.
+// The latest complete record of a rom is its save, without one the save area of the rom is. Records in
+// the way of a new one are written back to the save area of their rom first if they are its latest.
+#define SAVE_LOG_OFFSET 0x000be000     // Also in save_log.ld
+#define SAVE_LOG_SECTORS 64
+#define SAVE_LOG_MAGIC "pico-gb-save    "
+#define SAVE_ATTEMPTS 4         // While the game keeps writing the ram
+#define SAVE_RECORD_SECTORS(length) ((FLASH_PAGE_SIZE + (length) + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE)
+
+typedef union {
+    struct {
+        char magic[16];
+        uint32_t sequence;      // Across the log
+        uint32_t rom;           // Flash offset of the rom slot
+        uint32_t save;          // Flash offset of the save area of the rom
+        uint32_t tag;           // Header and global checksums of the rom
+        uint32_t generation;    // Of the saves of the rom
+        uint32_t length;
+        uint32_t data_crc;
+        uint32_t header_crc;    // Of the fields above
+    };
+    uint8_t page[FLASH_PAGE_SIZE];
+} save_record_t;
+
+// Clock of MBC3 carts, saved in the page after the ram. The time while powered off is not counted.
+#define RTC_SAVE_MAGIC 0x43545201
+typedef union {
+    struct {
+        uint32_t magic;
+        uint32_t seconds;
+        uint8_t halted;
+        uint8_t carry;
+    };
+    uint8_t page[FLASH_PAGE_SIZE];
+} rtc_save_t;
+
+rtc_save_t rtc_save;
+
+const save_record_t* save_records[SAVE_LOG_SECTORS];    // Record starting at each sector, NULL if none
+uint32_t save_log_sequence;     // Of the newest record
+int save_log_head;              // Sector after the newest record
+
+
+#ifdef LOAD_PAGED
+static inline __attribute__((always_inline)) const uint8_t* paged_bank_window(uint16_t bank, int i) {
+    bank &= rom_bank_mask;
+    uint8_t slot = bank_slots[bank];
+    if (slot == 0) {
+        // Not resident (yet)
+        return paged_rom + bank * 0x4000 + i * FRAME_LENGTH;
+    }
+    return frames[(slot - 1) * 4 + i];
+}
+
+static void __not_in_flash_func(start_frame_fill)() {
+    dma_channel_config c = dma_channel_get_default_config(paging_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    dma_channel_configure(paging_channel, &c, frames[fill_slot * 4 + fill_frame],
+        paged_rom + fill_bank * 0x4000 + fill_frame * FRAME_LENGTH, FRAME_LENGTH / 4, true);
+}
+
+#ifdef LAZY_LOAD
+static void __not_in_flash_func(start_preload)() {
+    while (preload_bank < preload_end && bank_slots[preload_bank] != 0) {
+        preload_bank++;
+    }
+    if (preload_bank >= preload_end) {
+        return;
+    }
+    // Only into a free slot, preloads never evict
+    for (int slot=1; slot<paged_slots; slot++) {
+        if (slot_banks[slot] == NO_BANK) {
+            fill_slot = slot;
+            fill_bank = preload_bank++;
+            fill_frame = 0;
+            fill_preload = true;
+            paging_busy = true;
+            start_frame_fill();
+            return;
+        }
+    }
+    preload_end = preload_bank;
+}
+#endif
+
+static void __not_in_flash_func(start_bank_fill)(uint16_t bank) {
+    // Least recently used slot
+    int victim = 1;
+    for (int slot=2; slot<paged_slots; slot++) {
+        if (slot_last_used[slot] < slot_last_used[victim]) {
+            victim = slot;
+        }
+    }
+    if (slot_banks[victim] != NO_BANK) {
+        bank_slots[slot_banks[victim]] = 0;
+        slot_banks[victim] = NO_BANK;
+    }
+    fill_slot = victim;
+    fill_bank = bank;
+    fill_frame = 0;
+#ifdef LAZY_LOAD
+    fill_preload = false;
+#endif
+    paging_busy = true;
+    start_frame_fill();
+}
+
+static void __not_in_flash_func(poll_paging)() {
+    if (dma_channel_is_busy(paging_channel)) {
+        return;
+    }
+    if (++fill_frame < 4) {
+        start_frame_fill();
+        return;
+    }
+    slot_banks[fill_slot] = fill_bank;
+    bank_slots[fill_bank] = fill_slot + 1;
+    slot_last_used[fill_slot] = ++paging_clock;
+    paging_busy = false;
+    if (fill_bank == paged_current_bank) {
+        // Move the regions from flash to the filled frames
+        for (int i=0; i<ROM_REGIONS/2; i++) {
+            read_regions[ROM_REGIONS/2 + i].base = frames[fill_slot * 4 + i];
+        }
+    } else if (bank_slots[paged_current_bank] == 0) {
+        // Switched again during the fill
+        start_bank_fill(paged_current_bank);
+    }
+#ifdef LAZY_LOAD
+    if (!paging_busy) {
+        start_preload();
+    }
+#endif
+}
+
+static inline __attribute__((always_inline)) void page_in_bank(uint16_t bank) {
+    bank &= rom_bank_mask;
+    paged_current_bank = bank;
+    uint8_t slot = bank_slots[bank];
+    if (slot != 0) {
+        slot_last_used[slot - 1] = ++paging_clock;
+    } else if (!paging_busy) {
+        start_bank_fill(bank);
+    }
+#ifdef LAZY_LOAD
+    else if (fill_preload && fill_bank == bank) {
+        fill_preload = false;
+    } else if (fill_preload) {
+        // The slot of the preload stays free, it is started again later
+        dma_channel_abort(paging_channel);
+        preload_bank = fill_bank;
+        start_bank_fill(bank);
+    }
+#endif
+}
+#endif
+
+static inline __attribute__((always_inline)) void set_rom_bank(uint16_t rombank) {
+#ifdef LOAD_PAGED
+    page_in_bank(rombank);
+#endif
+    for (int i=0; i<ROM_REGIONS/2; i++) {
+        map_region(ROM_REGIONS/2 + i, ROM_REGION(rombank, i), REGION_MASK);
+    }
+}
+
+// Cart ram as seen at 0xa000-0xbfff, NULL when disabled or out of range
+static inline __attribute__((always_inline)) uint8_t* ram_bank_window(bool enabled, uint8_t rambank) {
+    uint32_t end = (rambank + 1) << 13;
+    if (!enabled || end > cart.ramsize) {
+        return NULL;
+    }
+    return ram + (rambank << 13);
+}
+
+static inline __attribute__((always_inline)) void write_ram(uint8_t* byte, uint8_t data) {
+    *byte = data;
+    ram_dirty |= 1u << ((byte - ram) / FLASH_SECTOR_SIZE);
+}
+
+// MBC2 ram: 512 half-bytes
+#define MBC2_RAM_LENGTH 512
+#define MBC2_RAM_MASK (MBC2_RAM_LENGTH - 1)
+
+// MBC3 clock: a counter of seconds, running from the timer. The registers are only worked out when the game
+// latches or writes them. Written by the loop only, read by the save.
+#define RTC_SECONDS 0x08
+#define RTC_DAYS_HIGH 0x0c
+#define RTC_DAYS_HIGH_HALT 0x40
+#define RTC_DAYS_HIGH_CARRY 0x80
+#define RTC_DAY (24 * 60 * 60)
+#define RTC_DAYS 512
+uint32_t rtc_seconds;       // Counter at rtc_second_us, or while halted
+uint64_t rtc_second_us;     // Timer at the start of that second
+bool rtc_halted;
+bool rtc_carry;
+uint8_t rtc_registers[5];   // Latched: seconds, minutes, hours, days low, days high (halt, carry)
+volatile bool rtc_written;  // Since the last save
+uint32_t rtc_saved_seconds; // Counter of the last save
+
+static inline __attribute__((always_inline)) uint64_t rtc_now_us() {
+    // Raw timer: time_us_64() may run from flash
+    while (true) {
+        uint32_t high = timer_hw->timerawh;
+        uint32_t low = timer_hw->timerawl;
+        if (high == timer_hw->timerawh) {
+            return ((uint64_t) high << 32) | low;
+        }
+    }
+}
+
+static uint32_t __not_in_flash_func(rtc_counter)(uint64_t now_us, uint32_t* fraction_us) {
+    // 32-bit divisions only, libgcc's 64-bit ones are in flash
+    uint32_t seconds = rtc_seconds;
+    *fraction_us = 0;
+    if (!rtc_halted) {
+        uint64_t elapsed = now_us - rtc_second_us;
+        while (elapsed > 0xffffffffu) {
+            seconds += 4000;
+            elapsed -= 4000000000u;
+        }
+        seconds += (uint32_t) elapsed / 1000000;
+        *fraction_us = (uint32_t) elapsed % 1000000;
+    }
+    return seconds;
+}
+
+static void __not_in_flash_func(latch_rtc)() {
+    uint32_t fraction_us;
+    uint32_t seconds = rtc_counter(rtc_now_us(), &fraction_us);
+    uint32_t days = seconds / RTC_DAY;
+    seconds %= RTC_DAY;
+    rtc_registers[0] = seconds % 60;
+    rtc_registers[1] = (seconds / 60) % 60;
+    rtc_registers[2] = seconds / 3600;
+    rtc_registers[3] = days & 0xff;
+    rtc_registers[4] = ((days >> 8) & 0x01) | (rtc_halted ? RTC_DAYS_HIGH_HALT : 0)
+        | (rtc_carry || days >= RTC_DAYS ? RTC_DAYS_HIGH_CARRY : 0);
+}
+
+static void __not_in_flash_func(write_rtc)(uint8_t select, uint8_t data) {
+    uint64_t now_us = rtc_now_us();
+    uint32_t fraction_us;
+    uint32_t seconds = rtc_counter(now_us, &fraction_us);
+    uint32_t days = seconds / RTC_DAY;
+    rtc_carry = rtc_carry || days >= RTC_DAYS;
+    days %= RTC_DAYS;
+    seconds %= RTC_DAY;
+    uint32_t fields[5] = { seconds % 60, (seconds / 60) % 60, seconds / 3600, days & 0xff, days >> 8 };
+    fields[select - RTC_SECONDS] = data;
+    if (select == RTC_SECONDS) {
+        // Restarts the second
+        fraction_us = 0;
+    } else if (select == RTC_DAYS_HIGH) {
+        fields[4] = data & 0x01;
+        rtc_carry = (data & RTC_DAYS_HIGH_CARRY) != 0;
+        rtc_halted = (data & RTC_DAYS_HIGH_HALT) != 0;
+    }
+    rtc_seconds = fields[0] + fields[1] * 60 + fields[2] * 3600 + (fields[3] | (fields[4] << 8)) * RTC_DAY;
+    rtc_second_us = now_us - fraction_us;
+    rtc_registers[select - RTC_SECONDS] = data;
+    rtc_written = true;
+}
+
+// Latched clock register as seen at 0xa000-0xbfff instead of ram, NULL if none
+static inline __attribute__((always_inline)) uint8_t* rtc_register_window(bool enabled, uint8_t select) {
+    if (!enabled || !cart.has_rtc || select < RTC_SECONDS || select > RTC_DAYS_HIGH) {
+        return NULL;
+    }
+    return &rtc_registers[select - RTC_SECONDS];
+}
+
+
+int crc_channel = -1;
+uint32_t crc_sink;
+
+static uint32_t reverse_bits(uint32_t value) {
+    value = ((value >> 1) & 0x55555555) | ((value & 0x55555555) << 1);
+    value = ((value >> 2) & 0x33333333) | ((value & 0x33333333) << 2);
+    value = ((value >> 4) & 0x0f0f0f0f) | ((value & 0x0f0f0f0f) << 4);
+    return __builtin_bswap32(value);
+}
+
+static void start_crc32_sniffer(uint channel, uint32_t crc) {
+    // CRC32R only reverses the data: the register itself shifts MSB first. zlib's crc is that register
+    // reversed and inverted, on the way out, and the other way around to continue from it.
+    dma_sniffer_enable(channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_set_data_accumulator(reverse_bits(~crc));
+}
+
+uint32_t crc32_dma(uint32_t crc, const uint8_t* data, uint32_t size) {
+    // Same as zlib's crc32 (continued from crc), computed by the sniffer while a channel reads the data into a sink
+    if (crc_channel < 0) {
+        crc_channel = dma_claim_unused_channel(true);
+    }
+    dma_channel_config c = dma_channel_get_default_config(crc_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, true);
+    start_crc32_sniffer(crc_channel, crc);
+    if (size >= 4) {
+        dma_channel_configure(crc_channel, &c, &crc_sink, data, size / 4, true);
+        dma_channel_wait_for_finish_blocking(crc_channel);
+    }
+    if (size % 4 != 0) {
+        // Packed data ends anywhere
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        dma_channel_configure(crc_channel, &c, &crc_sink, data + size - size % 4, size % 4, true);
+        dma_channel_wait_for_finish_blocking(crc_channel);
+    }
+    crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    return crc;
+}
+
+static uint32_t save_length() {
+    return cart.ramsize + (cart.has_rtc ? sizeof(rtc_save_t) : 0);
+}
 
 uint8_t* ram_persistent_flash_addr() {
-    return selected_rom_addr + 0x100000 - cart.ramsize;
+    for (int i=0; i<my_roms.count; i++) {
+        if (my_roms.entries[i].address == selected_rom_addr && rom_saves[i] != NULL) {
+            return rom_saves[i];
+        }
+    }
+    // End of the last 1 MiB slot taken by the rom (roms larger than a slot span the next ones)
+    uint32_t stored = cart.packed_size > 0 ? cart.packed_size : cart.romsize;
+    // Whole sectors, with the clock page
+    uint32_t length = (save_length() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t slots = (SLOT_HEADER_LENGTH + stored + length + 0xfffff) / 0x100000;
+    return selected_rom_addr + slots * 0x100000 - length;
+}
+
+static uint32_t save_tag(const uint8_t* romdata) {
+    return romdata[0x14d] | (romdata[0x14e] << 8) | (romdata[0x14f] << 16);
+}
+
+static const uint8_t* save_record_data(const save_record_t* record) {
+    return record->page + FLASH_PAGE_SIZE;
+}
+
+static void scan_save_log() {
+    memset(save_records, 0, sizeof(save_records));
+    save_log_sequence = 0;
+    save_log_head = 0;
+    int sector = 0;
+    while (sector < SAVE_LOG_SECTORS) {
+        const save_record_t* record = (const save_record_t*) (XIP_BASE + SAVE_LOG_OFFSET + sector * FLASH_SECTOR_SIZE);
+        if (memcmp(record->magic, SAVE_LOG_MAGIC, 16) != 0 || record->length == 0
+            || SAVE_RECORD_SECTORS(record->length) > SAVE_LOG_SECTORS - sector
+            || crc32_dma(0, record->page, offsetof(save_record_t, header_crc)) != record->header_crc) {
+            // Erased, uncommitted, or the rest of an overwritten record
+            sector++;
+            continue;
+        }
+        save_records[sector] = record;
+        if (record->sequence >= save_log_sequence) {
+            save_log_sequence = record->sequence;
+            save_log_head = sector + SAVE_RECORD_SECTORS(record->length);
+        }
+        sector += SAVE_RECORD_SECTORS(record->length);
+    }
+}
+
+static const save_record_t* latest_save_record(uint32_t save, uint32_t before_generation) {
+    // Newest record of a save area, older than before_generation
+    const save_record_t* latest = NULL;
+    for (int i=0; i<SAVE_LOG_SECTORS; i++) {
+        const save_record_t* record = save_records[i];
+        if (record != NULL && record->save == save && record->generation < before_generation
+            && (latest == NULL || record->generation > latest->generation)) {
+            latest = record;
+        }
+    }
+    return latest;
+}
+
+static const save_record_t* valid_save_record(uint32_t save, uint32_t rom, uint32_t tag, uint32_t length) {
+    // Latest record of the rom whose data is intact
+    const save_record_t* record = latest_save_record(save, UINT32_MAX);
+    while (record != NULL && record->rom == rom && record->tag == tag && record->length == length) {
+        if (crc32_dma(0, save_record_data(record), length) == record->data_crc) {
+            return record;
+        }
+        DEBUGF("Save record %d of 0x%08x is corrupted\n", record->generation, save);
+        record = latest_save_record(save, record->generation);
+    }
+    // Records of a rom previously at this place are ignored
+    return NULL;
+}
+
+static void write_save_area(uint32_t offset, const uint8_t* data, uint32_t length) {
+    // Only the sectors that differ, data from flash goes through a page in RAM
+    static uint8_t page[FLASH_PAGE_SIZE];
+    const uint8_t* dest = (const uint8_t*) XIP_BASE + offset;
+    for (uint32_t start=0; start<length; start+=FLASH_SECTOR_SIZE) {
+        // The clock page ends the save in the middle of its last sector
+        uint32_t end = length - start < FLASH_SECTOR_SIZE ? length : start + FLASH_SECTOR_SIZE;
+        if (memcmp(dest + start, data + start, end - start) == 0) {
+            continue;
+        }
+        DEBUGF("Writing save sector 0x%08x\n", offset + start);
+        flash_range_erase(offset + start, FLASH_SECTOR_SIZE);
+        for (uint32_t i=start; i<end; i+=FLASH_PAGE_SIZE) {
+            memcpy(page, data + i, FLASH_PAGE_SIZE);
+            flash_range_program(offset + i, page, FLASH_PAGE_SIZE);
+        }
+    }
+}
+
+static void write_back_save_record(const save_record_t* record) {
+    if (latest_save_record(record->save, UINT32_MAX) != record) {
+        return;
+    }
+    // Only if the rom is still there
+    const uint8_t* slot = (const uint8_t*) XIP_BASE + record->rom;
+    if (memcmp(slot, magic, 16) != 0 || save_tag(slot + SLOT_HEADER_LENGTH) != record->tag
+        || crc32_dma(0, save_record_data(record), record->length) != record->data_crc) {
+        return;
+    }
+    DEBUGF("Writing back save record %d to 0x%08x\n", record->generation, record->save);
+    write_save_area(record->save, save_record_data(record), record->length);
 }
 
-void persist_ram_to_flash() {
-    if (selected_rom_addr != 0 && cart.ramsize > 0) {
-        uint32_t len = cart.ramsize;
-        uint8_t* dest = ram_persistent_flash_addr();
+const uint8_t* saved_ram() {
+    // Latest save of the selected rom
+    uint32_t save = (uint32_t) ram_persistent_flash_addr() - XIP_BASE;
+    scan_save_log();
+    const save_record_t* record = valid_save_record(save, (uint32_t) selected_rom_addr - XIP_BASE,
+        save_tag(selected_rom_addr + SLOT_HEADER_LENGTH), save_length());
+    if (record == NULL) {
+        return (const uint8_t*) XIP_BASE + save;
+    }
+    DEBUGF("Save record %d at 0x%08x\n", record->generation, record);
+    return save_record_data(record);
+}
+
+static int next_save_record(int sectors) {
+    // Next sectors of the ring, from the start if the record does not fit before the end
+    return save_log_head + sectors <= SAVE_LOG_SECTORS ? save_log_head : 0;
+}
 
-        DEBUGF("Persisting %d bytes of ram (0x%08x) to flash (0x%08x)\n", len, ram, dest);
-        uint32_t offset = ((uint32_t) dest) - XIP_BASE;
-        
-        DEBUGF("Erasing %p...%p\n", offset, offset + len);
-        flash_range_erase(offset, len);
-        
-        DEBUGF("Writing %p...%p from %p\n", offset, offset + len, ram);
-        flash_range_program(offset, ram, len);
+static bool flash_erased(uint32_t offset, uint32_t length) {
+    const uint32_t* words = (const uint32_t*) (XIP_BASE + offset);
+    for (uint32_t i=0; i<length/4; i++) {
+        if (words[i] != 0xffffffff) {
+            return false;
+        }
     }
+    return true;
 }
 
+static void clear_save_record(int first, int sectors) {
+    for (int i=0; i<SAVE_LOG_SECTORS; i++) {
+        const save_record_t* record = save_records[i];
+        if (record != NULL && i < first + sectors && i + SAVE_RECORD_SECTORS(record->length) > first) {
+            write_back_save_record(record);
+        }
+    }
+    uint32_t offset = SAVE_LOG_OFFSET + first * FLASH_SECTOR_SIZE;
+    if (!flash_erased(offset, sectors * FLASH_SECTOR_SIZE)) {
+        flash_range_erase(offset, sectors * FLASH_SECTOR_SIZE);
+    }
+}
+
+#ifdef AUTOSAVE
+void prepare_save_log() {
+    // Erases the sectors of the next record ahead, a save at power off then only programs them
+    if (selected_rom_addr != 0 && save_length() > 0) {
+        scan_save_log();
+        int sectors = SAVE_RECORD_SECTORS(save_length());
+        clear_save_record(next_save_record(sectors), sectors);
+    }
+}
+#endif
+
+static void snapshot_rtc() {
+    uint32_t fraction_us;
+    rtc_written = false;
+    memset(&rtc_save, 0xff, sizeof(rtc_save));
+    rtc_save.magic = RTC_SAVE_MAGIC;
+    rtc_save.seconds = rtc_counter(rtc_now_us(), &fraction_us);
+    rtc_save.halted = rtc_halted;
+    rtc_save.carry = rtc_carry;
+}
+
+static void restore_rtc(const rtc_save_t* saved) {
+    // Stopped at the last save while the console was off
+    bool valid = saved->magic == RTC_SAVE_MAGIC;
+    rtc_seconds = valid ? saved->seconds : 0;
+    rtc_halted = valid && saved->halted;
+    rtc_carry = valid && saved->carry;
+    rtc_second_us = rtc_now_us();
+    rtc_saved_seconds = rtc_seconds;
+    rtc_written = false;
+    latch_rtc();
+}
+
+static bool rtc_changed(uint32_t seconds) {
+    uint32_t fraction_us;
+    return cart.has_rtc && (rtc_written || rtc_counter(rtc_now_us(), &fraction_us) - rtc_saved_seconds >= seconds);
+}
+
+bool persist_ram_to_flash() {
+    if (selected_rom_addr == 0 || save_length() == 0 || (ram_dirty == 0 && !rtc_changed(1))) {
+        return true;
+    }
+    const uint8_t* saved = saved_ram();
+    ram_dirty = 0;
+    if (cart.has_rtc) {
+        snapshot_rtc();
+    }
+    if (memcmp(ram, saved, cart.ramsize) == 0
+        && (!cart.has_rtc || memcmp(rtc_save.page, saved + cart.ramsize, sizeof(rtc_save)) == 0)) {
+        DEBUGF("Ram unchanged\n");
+        return true;
+    }
+
+    uint32_t length = save_length();
+    int sectors = SAVE_RECORD_SECTORS(length);
+    int first = next_save_record(sectors);
+    clear_save_record(first, sectors);
+
+    static save_record_t record;
+    memset(&record, 0xff, sizeof(record));
+    memcpy(record.magic, SAVE_LOG_MAGIC, 16);
+    record.sequence = save_log_sequence + 1;
+    record.rom = (uint32_t) selected_rom_addr - XIP_BASE;
+    record.save = (uint32_t) ram_persistent_flash_addr() - XIP_BASE;
+    record.tag = save_tag(selected_rom_addr + SLOT_HEADER_LENGTH);
+    const save_record_t* latest = latest_save_record(record.save, UINT32_MAX);
+    record.generation = latest != NULL ? latest->generation + 1 : 1;
+    record.length = length;
+
+    uint32_t offset = SAVE_LOG_OFFSET + first * FLASH_SECTOR_SIZE;
+    const uint8_t* data = (const uint8_t*) XIP_BASE + offset + FLASH_PAGE_SIZE;
+    for (int attempt=0; attempt<SAVE_ATTEMPTS; attempt++) {
+        ram_dirty = 0;
+        if (cart.has_rtc) {
+            snapshot_rtc();
+        }
+        record.data_crc = crc32_dma(crc32_dma(0, ram, cart.ramsize), rtc_save.page, length - cart.ramsize);
+        DEBUGF("Persisting ram (0x%08x) as save record %d at 0x%08x\n", ram, record.generation, offset);
+        if (attempt > 0) {
+            flash_range_erase(offset, sectors * FLASH_SECTOR_SIZE);
+        }
+        if (cart.ramsize > 0) {
+            flash_range_program(offset + FLASH_PAGE_SIZE, ram, cart.ramsize);
+        }
+        if (cart.has_rtc) {
+            flash_range_program(offset + FLASH_PAGE_SIZE + cart.ramsize, rtc_save.page, sizeof(rtc_save));
+        }
+        // Written by the game meanwhile: the record may mix two saves, it is left uncommitted
+        if (ram_dirty != 0 || rtc_written || crc32_dma(0, data, length) != record.data_crc) {
+            DEBUGF("Ram written while persisted\n");
+            ram_dirty = 1;
+            continue;
+        }
+        // Commit
+        record.header_crc = crc32_dma(0, record.page, offsetof(save_record_t, header_crc));
+        flash_range_program(offset, record.page, FLASH_PAGE_SIZE);
+        rtc_saved_seconds = rtc_save.seconds;
+        return true;
+    }
+    return false;
+}
+
+#ifdef AUTOSAVE
+// Console watched by core0 while the loop runs on core1, with the clock toggling and /RESET high while it
+// runs: the ram is saved when it stops (powered off), and every AUTOSAVE_INTERVAL_US while it runs
+#define POWER_OFF_TIMEOUT_US 10000
+#define AUTOSAVE_INTERVAL_US (30 * 1000000)
+#define RTC_AUTOSAVE_SECONDS 600    // The clock alone is saved every 10 minutes at most
+bool console_off = true;    // Until seen running
+uint64_t console_active_us;
+uint64_t autosave_us;
+uint64_t monitor_poll_us;
+
+save_trigger_t monitor_console(uint64_t now_us, bool active) {
+    // Core0 did not poll meanwhile (blocked by a flash write): the console may have run all along, the
+    // power-off timeout starts over
+    if (now_us - monitor_poll_us >= POWER_OFF_TIMEOUT_US) {
+        console_active_us = now_us;
+    }
+    monitor_poll_us = now_us;
+    if (active) {
+        if (console_off) {
+            console_off = false;
+            autosave_us = now_us;
+        }
+        console_active_us = now_us;
+    } else if (!console_off && now_us - console_active_us >= POWER_OFF_TIMEOUT_US) {
+        console_off = true;
+        return ram_dirty != 0 || rtc_changed(1) ? SAVE_POWER_OFF : SAVE_NONE;
+    }
+    if (!console_off && now_us - autosave_us >= AUTOSAVE_INTERVAL_US) {
+        autosave_us = now_us;
+        return ram_dirty != 0 || rtc_changed(RTC_AUTOSAVE_SECONDS) ? SAVE_PERIODIC : SAVE_NONE;
+    }
+    return SAVE_NONE;
+}
+#endif
+
 uint8_t* selected_rom() {
     return selected_rom_addr;
 }
@@ -91,11 +1014,266 @@ void pin_cache_lines() {
     DEBUGF("Pinned\n");
 }
 
+#ifdef BUS_PIO
+// Entry point of each state machine
+uint bus_pio_starts[3];
+
+#ifdef BUS_DMA
+int bus_dma_address_channel;
+int bus_dma_data_channel;
+
+void init_bus_dma() {
+    DEBUGF("Starting DMA ROM reads\n");
+    bus_dma_address_channel = dma_claim_unused_channel(true);
+    bus_dma_data_channel = dma_claim_unused_channel(true);
+
+    // Byte address pushed by the ROM state machine -> read address of the data channel, which starts it
+    dma_channel_config c = dma_channel_get_default_config(bus_dma_address_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(BUS_PIO_INSTANCE, BUS_SM_ROM, false));
+    dma_channel_configure(bus_dma_address_channel, &c, &dma_hw->ch[bus_dma_data_channel].al3_read_addr_trig,
+        &BUS_PIO_INSTANCE->rxf[BUS_SM_ROM], 1, false);
+
+    // ROM byte -> ROM state machine, then re-arm the address channel
+    c = dma_channel_get_default_config(bus_dma_data_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_chain_to(&c, bus_dma_address_channel);
+    dma_channel_configure(bus_dma_data_channel, &c, &BUS_PIO_INSTANCE->txf[BUS_SM_ROM], NULL, 1, false);
+}
+#endif
+
+void init_bus_pio() {
+    DEBUGF("Starting PIO bus front-end\n");
+#ifdef BUS_DMA
+    // Loaded first, at 0
+    uint offset = pio_add_program(BUS_PIO_INSTANCE, &gb_bus_read_dma_program);
+    gb_bus_read_dma_program_init(BUS_PIO_INSTANCE, BUS_SM_READ, offset, false);
+    bus_pio_starts[BUS_SM_READ] = offset + gb_bus_read_dma_offset_cpu_start;
+    gb_bus_read_dma_program_init(BUS_PIO_INSTANCE, BUS_SM_ROM, offset, true);
+    bus_pio_starts[BUS_SM_ROM] = offset + gb_bus_read_dma_offset_rom_start;
+    init_bus_dma();
+#else
+    bus_pio_starts[BUS_SM_READ] = pio_add_program(BUS_PIO_INSTANCE, &gb_bus_read_program);
+    gb_bus_read_program_init(BUS_PIO_INSTANCE, BUS_SM_READ, bus_pio_starts[BUS_SM_READ]);
+#endif
+    bus_pio_starts[BUS_SM_WRITE] = pio_add_program(BUS_PIO_INSTANCE, &gb_bus_write_program);
+    gb_bus_write_program_init(BUS_PIO_INSTANCE, BUS_SM_WRITE, bus_pio_starts[BUS_SM_WRITE]);
+}
+
+void reset_bus_pio() {
+#ifdef BUS_DMA
+    uint last_sm = BUS_SM_ROM;
+    dma_channel_abort(bus_dma_address_channel);
+    dma_channel_abort(bus_dma_data_channel);
+#else
+    uint last_sm = BUS_SM_WRITE;
+#endif
+    // Drop cycles latched for the previous loop (e.g. writes ignored by the launcher) and release D0-D7
+    for (uint sm = BUS_SM_READ; sm <= last_sm; sm++) {
+        pio_sm_set_enabled(BUS_PIO_INSTANCE, sm, false);
+        pio_sm_clear_fifos(BUS_PIO_INSTANCE, sm);
+        pio_sm_restart(BUS_PIO_INSTANCE, sm);
+        pio_sm_exec(BUS_PIO_INSTANCE, sm, pio_encode_jmp(bus_pio_starts[sm]));
+    }
+    // Decode of the reads above 0x8000 (bus.pio)
+    pio_sm_exec(BUS_PIO_INSTANCE, BUS_SM_READ, pio_encode_set(pio_y, CART_RAM_A14_A13));
+    pio_sm_set_consecutive_pindirs(BUS_PIO_INSTANCE, BUS_SM_READ, GB_DATA_PINS_SHIFT, 8, false);
+#ifdef BUS_DMA
+    // Banks 0 and 1 of the new ROM
+    gb_bus_read_dma_set_bank(BUS_PIO_INSTANCE, BUS_SM_ROM, pio_y, read_regions[0].base);
+    gb_bus_read_dma_set_bank(BUS_PIO_INSTANCE, BUS_SM_ROM, pio_x, read_regions[ROM_REGIONS/2].base);
+    dma_channel_start(bus_dma_address_channel);
+#endif
+    for (uint sm = BUS_SM_READ; sm <= last_sm; sm++) {
+        pio_sm_set_enabled(BUS_PIO_INSTANCE, sm, true);
+    }
+}
+#endif
+
+#ifdef ROM_UNPACK
+// Bytes from pos to the end of its rom window
+#define UNPACK_RUN(pos) ((1u << ROM_WINDOW_SHIFT) - ((pos) & ROM_WINDOW_MASK))
+
+static inline __attribute__((always_inline)) uint8_t* unpack_ptr(uint32_t pos) {
+    return (uint8_t*) ROM_BANK_WINDOW(pos >> 14, (pos & 0x3fff) >> ROM_WINDOW_SHIFT) + (pos & ROM_WINDOW_MASK);
+}
+
+static inline __attribute__((always_inline)) uint32_t unpack_length(const uint8_t** src, const uint8_t* end,
+    uint32_t n) {
+    // Extension bytes of a 15 nibble
+    uint8_t b;
+    do {
+        if (*src >= end) {
+            return UINT32_MAX;
+        }
+        b = *(*src)++;
+        n += b;
+    } while (b == 255);
+    return n;
+}
+
+static inline __attribute__((always_inline)) void unpack_literals(uint32_t pos, const uint8_t* src, uint32_t n) {
+    while (n > 0) {
+        uint32_t run = n < UNPACK_RUN(pos) ? n : UNPACK_RUN(pos);
+        memcpy(unpack_ptr(pos), src, run);
+        src += run;
+        pos += run;
+        n -= run;
+    }
+}
+
+static inline __attribute__((always_inline)) void unpack_match(uint32_t pos, uint32_t offset, uint32_t n) {
+    // Overlapping matches (offset < n) repeat the offset bytes before pos: copy from the furthest repeat
+    // written so far, which doubles the run length each time
+    uint32_t start = pos;
+    uint32_t distance = offset;
+    while (n > 0) {
+        uint32_t from = pos - distance;
+        uint32_t run = n < distance ? n : distance;
+        run = run < UNPACK_RUN(pos) ? run : UNPACK_RUN(pos);
+        run = run < UNPACK_RUN(from) ? run : UNPACK_RUN(from);
+        memcpy(unpack_ptr(pos), unpack_ptr(from), run);
+        pos += run;
+        n -= run;
+        distance = (pos - start + offset) / offset * offset;
+    }
+}
+
+// Packed rom: the cartridge header (0x0000-0x014f) as is, then the rest as an LZ4 block, whose matches
+// may reach into the header. Decodes the first length bytes of the rom, false if the data is invalid.
+static bool __not_in_flash_func(unpack_rom)(const uint8_t* src, uint32_t packed_size, uint32_t length) {
+    if (packed_size < ROM_HEADER_END || length < ROM_HEADER_END) {
+        return false;
+    }
+    const uint8_t* end = src + packed_size;
+    unpack_literals(0, src, ROM_HEADER_END);
+    src += ROM_HEADER_END;
+    uint32_t pos = ROM_HEADER_END;
+    while (src < end) {
+        uint8_t token = *src++;
+        uint32_t n = token >> 4;
+        if (n == 15) {
+            n = unpack_length(&src, end, n);
+        }
+        if (n > end - src || n > length - pos) {
+            return false;
+        }
+        unpack_literals(pos, src, n);
+        src += n;
+        pos += n;
+        if (src == end) {
+            // The last sequence has no match
+            break;
+        }
+        if (end - src < 2) {
+            return false;
+        }
+        uint32_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        n = token & 0xf;
+        if (n == 15) {
+            n = unpack_length(&src, end, n);
+        }
+        if (offset == 0 || offset > pos || n >= length || n + 4 > length - pos) {
+            return false;
+        }
+        unpack_match(pos, offset, n + 4);
+        pos += n + 4;
+    }
+    return pos == length;
+}
+
+static void unpack_banks(const uint8_t* packed, uint32_t packed_size, uint32_t length) {
+    DEBUGF("Unpacking %d bytes ROM from %d bytes\n", length, packed_size);
+    if (!unpack_rom(packed, packed_size, length)) {
+        DEBUGF("ROM unpack error\n");
+    }
+}
+#endif
+
+#ifdef LOAD_DMA
+static void start_load_dma(const void* src) {
+    if (load_data_channel < 0) {
+        load_data_channel = dma_claim_unused_channel(true);
+        load_ctrl_channel = dma_claim_unused_channel(true);
+    }
+    // One bank per block, triggered by the write of its bank address
+    dma_channel_config c = dma_channel_get_default_config(load_data_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_chain_to(&c, load_ctrl_channel);
+    channel_config_set_sniff_enable(&c, true);
+    channel_config_set_irq_quiet(&c, true);
+    dma_channel_configure(load_data_channel, &c, NULL, NULL, BANK_LENGTH / 4, false);
+
+    // Writes each block to READ_ADDR and WRITE_ADDR_TRIG of the data channel
+    c = dma_channel_get_default_config(load_ctrl_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 3);
+    dma_channel_acknowledge_irq0(load_data_channel);
+    start_crc32_sniffer(load_data_channel, 0);
+    dma_channel_configure(load_ctrl_channel, &c, &dma_hw->ch[load_data_channel].al2_read_addr, src, 2, true);
+}
+
+static uint32_t wait_load_dma() {
+    // Raised by the null block
+    while ((dma_hw->intr & (1u << load_data_channel)) == 0) {
+        tight_loop_contents();
+    }
+    dma_channel_acknowledge_irq0(load_data_channel);
+    uint32_t crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    return crc;
+}
+
+void load_banks_dma(const uint8_t* romdata, int banks_count) {
+    DEBUGF("Loading %d ROM banks by DMA\n", banks_count);
+    for (int i=0; i<banks_count; i++) {
+        load_blocks[i].read_addr = (uint32_t) (romdata + i*BANK_LENGTH);
+        load_blocks[i].write_addr = (uint32_t) banks[i];
+    }
+    load_blocks[banks_count].read_addr = 0;
+    load_blocks[banks_count].write_addr = 0;
+    load_banks_count = banks_count;
+    start_load_dma(load_blocks);
+}
+
+void finish_load_dma() {
+    if (load_banks_count < 0) {
+        return;
+    }
+    load_crc = wait_load_dma();
+    // Verify ROM: crc of the bytes read from flash, against the one stored in the slot (CRC32 slots of a
+    // whole number of banks)
+    const uint8_t* slot = selected_rom_addr;
+    if (slot == NULL || load_blocks[0].read_addr != (uint32_t) (slot + SLOT_HEADER_LENGTH)
+        || slot[21] != SLOT_CHECKSUM_CRC32 || load_banks_count * BANK_LENGTH != cart.romsize) {
+        DEBUGF("ROM banks not verified, crc 0x%08x\n", load_crc);
+    } else if (load_crc != *((uint32_t*) (slot + 28))) {
+        DEBUGF("ROM banks mismatch: crc 0x%08x, expected 0x%08x\n", load_crc, *((uint32_t*) (slot + 28)));
+    } else {
+        DEBUGF("ROM banks verified, crc 0x%08x\n", load_crc);
+    }
+    load_banks_count = -1;
+}
+#endif
+
 #ifdef LOAD_NO_BANKS
-void load_no_banks(const uint8_t* romdata, uint32_t size) {
-    if (size > ROM_MAX_LENGTH) {
-        DEBUGF("Unsupported ROM size: %d > %d\n", size, ROM_MAX_LENGTH);
-        size = ROM_MAX_LENGTH;
+void load_no_banks(const uint8_t* romdata, uint32_t size, uint32_t packed_size) {
+    if (size > ROM_MAX_LENGTH - ram_reserved) {
+        DEBUGF("Unsupported ROM size: %d > %d\n", size, ROM_MAX_LENGTH - ram_reserved);
+        size = ROM_MAX_LENGTH - ram_reserved;
+    }
+    if (packed_size > 0) {
+        unpack_banks(romdata, packed_size, size);
+        return;
     }
     DEBUGF("Loading %d bytes ROM\n", size);
     memcpy(sram_rom, romdata, size);
@@ -107,20 +1285,37 @@ void load_no_banks(const uint8_t* romdata, uint32_t size) {
 #endif
 
 #ifdef LOAD_BANKS_16K
-void load_banks_16k(const uint8_t* romdata, uint32_t size) {
+void load_banks_16k(const uint8_t* romdata, uint32_t size, uint32_t packed_size) {
+    // Banks taken by the ram last, out of reach of the rom
+    int available = ROM_BANKS_COUNT - ram_reserved / BANK_LENGTH;
+#ifdef SAVE_BACKGROUND
+    // Bank 31 is left out, there is no bank in pinned cache
     for (int i=0; i<31; i++) {
         banks[i] = sram_banks[i];
     }
-    banks[31] = xip_bank31;
+#else
+    for (int i=0; i<31; i++) {
+        banks[i < available - 1 ? i : i + 1] = sram_banks[i];
+    }
+    banks[available - 1] = xip_bank31;
     // Bank 31 will NOT be zero-initialized by the BSS routine
     memset(xip_bank31, 0, BANK_LENGTH);
+#endif
     // Load ROM into RAM
     int banks_count = size / BANK_LENGTH;
     DEBUGF("ROM size: %d Banks count: %d\n", size, banks_count);
-    if (banks_count > MAX_BANKS_COUNT) {
-        DEBUGF("Unsupported ROM size: %d banks > %d\n", banks_count, MAX_BANKS_COUNT);
-        banks_count = MAX_BANKS_COUNT;
+    if (banks_count > available) {
+        DEBUGF("Unsupported ROM size: %d banks > %d\n", banks_count, available);
+        banks_count = available;
     }
+    if (packed_size > 0) {
+        unpack_banks(romdata, packed_size, banks_count * BANK_LENGTH);
+        return;
+    }
+#ifdef LOAD_DMA
+    // Completed by finish_load_dma()
+    load_banks_dma(romdata, banks_count);
+#else
     DEBUGF("Loading %d ROM banks\n", banks_count);
     for (int i=0; i<banks_count; i++) {
         memcpy(banks[i], romdata + i*BANK_LENGTH, BANK_LENGTH);
@@ -132,29 +1327,48 @@ void load_banks_16k(const uint8_t* romdata, uint32_t size) {
         }
     }
     DEBUGF("ROM banks verified\n");
+#endif
 }
 #endif
 
 #ifdef LOAD_BANKS_4K
-void load_banks_4k(const uint8_t* romdata, uint32_t size) {
+void load_banks_4k(const uint8_t* romdata, uint32_t size, uint32_t packed_size) {
+    // Banks taken by the ram last, out of reach of the rom
+    int available = ROM_BANKS_COUNT - ram_reserved / BANK_LENGTH;
+#ifdef SAVE_BACKGROUND
+    // Banks 124-127 are left out, there is no bank in pinned cache
     for (int i=0; i<123; i++) {
-        banks[i] = sram_banks[i];
+        banks[i < available - 1 ? i : i + 1] = sram_banks[i];
     }
-    banks[123] = xip_banks;
-    banks[124] = xip_banks + BANK_LENGTH;
-    banks[125] = xip_banks + 2*BANK_LENGTH;
-    banks[126] = xip_banks + 3*BANK_LENGTH;
-    banks[127] = usb_bank;
+    banks[available - 1] = usb_bank;
+#else
+    for (int i=0; i<123; i++) {
+        banks[i < available - 5 ? i : i + 5] = sram_banks[i];
+    }
+    banks[available - 5] = xip_banks;
+    banks[available - 4] = xip_banks + BANK_LENGTH;
+    banks[available - 3] = xip_banks + 2*BANK_LENGTH;
+    banks[available - 2] = xip_banks + 3*BANK_LENGTH;
+    banks[available - 1] = usb_bank;
     // Banks 123+ will NOT be zero-initialized by the BSS routine
     memset(xip_banks, 0, 4*BANK_LENGTH);
+#endif
     memset(usb_bank, 0, BANK_LENGTH);
     // Load ROM into RAM
     int banks_count = size / BANK_LENGTH;
     DEBUGF("ROM size: %d Banks count: %d\n", size, banks_count);
-    if (banks_count > MAX_BANKS_COUNT) {
-        DEBUGF("Unsupported ROM size: %d banks > %d\n", banks_count, MAX_BANKS_COUNT);
-        banks_count = MAX_BANKS_COUNT;
+    if (banks_count > available) {
+        DEBUGF("Unsupported ROM size: %d banks > %d\n", banks_count, available);
+        banks_count = available;
+    }
+    if (packed_size > 0) {
+        unpack_banks(romdata, packed_size, banks_count * BANK_LENGTH);
+        return;
     }
+#ifdef LOAD_DMA
+    // Completed by finish_load_dma()
+    load_banks_dma(romdata, banks_count);
+#else
     DEBUGF("Loading %d ROM banks\n", banks_count);
     for (int i=0; i<banks_count; i++) {
         memcpy(banks[i], romdata + i*BANK_LENGTH, BANK_LENGTH);
@@ -166,29 +1380,131 @@ void load_banks_4k(const uint8_t* romdata, uint32_t size) {
         }
     }
     DEBUGF("ROM banks verified\n");
+#endif
 }
 #endif
 
-cart_t init_rom(const uint8_t* romdata, uint32_t size) {
-    // Pin cache lines if required
-#if defined(LOAD_BANKS_16K) || defined(LOAD_BANKS_4K)
-    pin_cache_lines();
-#endif
+#ifdef LOAD_PAGED
+void load_paged(const uint8_t* romdata, uint32_t size) {
+    // Frames taken by the ram last, in no slot
+    int available = FRAMES_COUNT - ram_reserved / FRAME_LENGTH;
+    paged_slots = available / 4;
+    for (int i=0; i<123; i++) {
+        frames[i < available - 5 ? i : i + 5] = sram_frames[i];
+    }
+    for (int i=0; i<4; i++) {
+        frames[available - 5 + i] = xip_frames + i*FRAME_LENGTH;
+    }
+    frames[available - 1] = usb_frame;
+    // Frames 123+ will NOT be zero-initialized by the BSS routine
+    memset(xip_frames, 0, 4*FRAME_LENGTH);
+    memset(usb_frame, 0, FRAME_LENGTH);
 
-    // Copy to RAM if required
-#ifdef LOAD_NO_BANKS
-    load_no_banks(romdata, size);
-#endif
+    if (paging_channel < 0) {
+        paging_channel = dma_claim_unused_channel(true);
+    }
+    dma_channel_abort(paging_channel);
+    paging_busy = false;
 
-#ifdef LOAD_BANKS_16K
-    load_banks_16k(romdata, size);
+    paged_rom = romdata;
+    int banks_count = size / 0x4000;
+    if (banks_count > MAX_ROM_BANKS) {
+        DEBUGF("Unsupported ROM size: %d banks > %d\n", banks_count, MAX_ROM_BANKS);
+        banks_count = MAX_ROM_BANKS;
+    }
+    DEBUGF("ROM size: %d Banks count: %d\n", size, banks_count);
+
+    // Preload as many banks as there are slots
+    memset(bank_slots, 0, sizeof(bank_slots));
+    for (int slot=0; slot<PAGED_SLOTS_COUNT; slot++) {
+        slot_last_used[slot] = 0;
+        if (slot >= paged_slots) {
+            slot_banks[slot] = NO_BANK;
+            continue;
+        }
+#ifdef LAZY_LOAD
+        // Only bank 0 (and the header) before reset is released, the others are read from flash until preloaded
+        if (slot > 0) {
+            slot_banks[slot] = NO_BANK;
+            continue;
+        }
+#endif
+        if (slot >= banks_count) {
+            slot_banks[slot] = NO_BANK;
+            continue;
+        }
+        for (int i=0; i<4; i++) {
+            memcpy(frames[slot*4 + i], romdata + slot*0x4000 + i*FRAME_LENGTH, FRAME_LENGTH);
+        }
+        slot_banks[slot] = slot;
+        bank_slots[slot] = slot + 1;
+    }
+#ifdef LAZY_LOAD
+    preload_bank = 1;
+    preload_end = banks_count < paged_slots ? banks_count : paged_slots;
+    start_preload();
+    DEBUGF("Preloading %d ROM banks in the background\n", preload_end - 1);
+#else
+    DEBUGF("Preloaded %d ROM banks\n", banks_count < paged_slots ? banks_count : paged_slots);
+#endif
+}
 #endif
 
-#ifdef LOAD_BANKS_4K
-    load_banks_4k(romdata, size);
+static bool cart_type_has_ram(uint8_t type) {
+    return type == 0x02 || type == 0x03 || type == 0x05 || type == 0x06 || type == 0x10 || type == 0x12
+        || type == 0x13 || type == 0x1a || type == 0x1b || type == 0x1d || type == 0x1e;
+}
+
+static uint32_t header_ram_size(const uint8_t* romdata) {
+    if (romdata[0x147] == 0x05 || romdata[0x147] == 0x06) {
+        // MBC2: 512 half-bytes built in, not in the header
+        return MBC2_RAM_LENGTH;
+    }
+    if (!cart_type_has_ram(romdata[0x147])) {
+        return 0;
+    }
+    switch (romdata[0x149]) {
+        case 2: return 8 * 1024;
+        case 3: return 32 * 1024;
+        case 4: return 128 * 1024;
+        case 5: return 64 * 1024;
+        default: return 0;
+    }
+}
+
+// Rom bytes the backend holds next to ramsize bytes of cart ram. LOAD_PAGED pages larger roms in, NO_LOAD
+// reads them from flash.
+static uint32_t rom_capacity(uint32_t ramsize) {
+#if defined(LOAD_NO_BANKS) || defined(LOAD_BANKS_16K) || defined(LOAD_BANKS_4K)
+    uint32_t reserved = ramsize > sizeof(ram_8k) ? ramsize : 0;
+#endif
+#if defined(LOAD_NO_BANKS)
+    return ROM_MAX_LENGTH - reserved;
+#elif defined(LOAD_BANKS_16K) || defined(LOAD_BANKS_4K)
+    return ROM_BANKS_COUNT * BANK_LENGTH - reserved;
+#elif defined(LOAD_PAGED)
+    return MAX_ROM_BANKS * 0x4000;
+#else
+    return UINT32_MAX;
 #endif
+}
 
-    DEBUGF("Loaded ROM at 0x%p\n", romdata);
+static void reserve_ram(uint32_t ramsize) {
+    if (ramsize <= sizeof(ram_8k)) {
+        ram = ram_8k;
+        ram_reserved = 0;
+        return;
+    }
+    ram = (uint8_t*) RAM_POOL + sizeof(RAM_POOL) - ramsize;
+    ram_reserved = ramsize;
+    DEBUGF("RAM: %d KiB taken from ROM storage\n", ramsize / 1024);
+}
+
+cart_t init_rom(const uint8_t* romdata, uint32_t size, uint32_t packed_size) {
+    // Pin cache lines if required
+#if (defined(LOAD_BANKS_16K) || defined(LOAD_BANKS_4K) || defined(LOAD_PAGED)) && !defined(SAVE_BACKGROUND)
+    pin_cache_lines();
+#endif
 
     memset(&cart, 0, sizeof(cart));
 
@@ -199,26 +1515,23 @@ cart_t init_rom(const uint8_t* romdata, uint32_t size) {
 
     // TODO Read ROM size from header ?!
     cart.romsize = size;
-
-    if (cart.type == 0x02 || cart.type == 0x03 || cart.type == 0x1a || cart.type == 0x1b || cart.type == 0x1d || cart.type == 0x1e) {
-        cart.has_ram = true;
-        if (cart.ram < 2) {
-            cart.ramsize = 0;
-        } else if (cart.ram == 2) {
-            cart.ramsize = 8 * 1024;
-        } else if (cart.ram == 3) {
-            cart.ramsize = 32 * 1024;
-        } else if (cart.ram == 4) {
-            cart.ramsize = 128 * 1024;
-        } else if (cart.ram == 5) {
-            cart.ramsize = 64 * 1024;
-        }
+    cart.packed_size = packed_size;
+    rom_bank_mask = 1;
+    while ((rom_bank_mask + 1) * 0x4000 < size) {
+        rom_bank_mask = (rom_bank_mask << 1) | 1;
     }
 
-    if (cart.type == 0x03 || cart.type == 0x1b || cart.type == 0x1e) {
+    cart.has_ram = cart_type_has_ram(cart.type);
+    cart.ramsize = header_ram_size(romdata);
+
+    if (cart.type == 0x03 || cart.type == 0x06 || cart.type == 0x0f || cart.type == 0x10 || cart.type == 0x13 || cart.type == 0x1b || cart.type == 0x1e) {
         cart.has_battery = true;
     }
 
+    if (cart.type == 0x0f || cart.type == 0x10) {
+        cart.has_rtc = true;
+    }
+
     if (cart.type == 0x1c || cart.type == 0x1d || cart.type == 0x1e) {
         cart.has_rumble = true;
     }
@@ -227,45 +1540,118 @@ cart_t init_rom(const uint8_t* romdata, uint32_t size) {
         cart.loop = &loop_32kb;
         DEBUGF("ROM type: 32KiB bankless\n");
     } else if (cart.type >= 0x01 && cart.type <= 0x03) { // MBC1
-        cart.loop = &loop_mbc1;
+        cart.loop = cart.ramsize > 0 ? &loop_mbc1 : &loop_mbc1_rom_only;
         DEBUGF("ROM type: MBC1\n");
+    } else if (cart.type == 0x05 || cart.type == 0x06) { // MBC2
+        cart.loop = &loop_mbc2;
+        DEBUGF("ROM type: MBC2\n");
+    } else if (cart.type >= 0x0f && cart.type <= 0x13) { // MBC3
+        cart.loop = cart.has_rtc ? &loop_mbc3_rtc : cart.ramsize > 0 ? &loop_mbc3 : &loop_mbc3_rom_only;
+        DEBUGF("ROM type: MBC3\n");
     } else if (cart.type >= 0x19 && cart.type <= 0x1e) { // MBC5
-        cart.loop = &loop_mbc5;
+        if (cart.ramsize == 0) {
+            cart.loop = &loop_mbc5_rom_only;
+        } else {
+            cart.loop = cart.has_rumble ? &loop_mbc5_rumble : &loop_mbc5;
+        }
         DEBUGF("ROM type: MBC5\n");
     } else {
         DEBUGF("ROM type: Unsupported\n");
     }
 
+    // Also refused by find_rom_entries: the last banks would be the ram
+    if (size > rom_capacity(cart.ramsize)) {
+        DEBUGF("ROM size: %d > %d next to %d bytes of RAM\n", size, rom_capacity(cart.ramsize), cart.ramsize);
+        cart.loop = NULL;
+        return cart;
+    }
+
+    // Larger ram out of the way of the rom banks
+    reserve_ram(cart.ramsize);
+
+    // Copy to RAM if required
+#ifdef LOAD_NO_BANKS
+    load_no_banks(romdata, size, packed_size);
+#endif
+
+#ifdef LOAD_BANKS_16K
+    load_banks_16k(romdata, size, packed_size);
+#endif
+
+#ifdef LOAD_BANKS_4K
+    load_banks_4k(romdata, size, packed_size);
+#endif
+
+#ifdef LOAD_PAGED
+    load_paged(romdata, size);
+#endif
+
+#ifdef NO_LOAD
+    rom = romdata;
+#endif
+
+    // Bank 0 at 0x0000-0x3fff, bank 1 at 0x4000-0x7fff, open bus past the end of smaller roms and above
+    for (int i=0; i<REGIONS; i++) {
+        map_region(i, NULL, 0);
+    }
+    for (int i=0; i<ROM_REGIONS/2; i++) {
+        map_region(i, ROM_REGION(0, i), REGION_MASK);
+    }
+    set_rom_bank(1);
+    for (int i=0; i<ROM_REGIONS; i++) {
+        if ((i << REGION_SHIFT) >= size) {
+            map_region(i, NULL, 0);
+        }
+    }
+
+#ifdef BUS_PIO
+    reset_bus_pio();
+#endif
+
+    DEBUGF("Loaded ROM at 0x%p\n", romdata);
+
+#ifdef LOAD_DMA
+    // Banks loaded while the regions were set up, the sniffer is free again for the save log
+    finish_load_dma();
+#endif
+
     // Load ram from flash
-    if (selected_rom_addr != 0 && cart.ramsize > 0) {
-        uint8_t* src = ram_persistent_flash_addr();
+    if (selected_rom_addr != 0 && save_length() > 0) {
+        const uint8_t* src = saved_ram();
         DEBUGF("Loading RAM from 0x%08x\n", src);
-        if (cart.ramsize > sizeof(ram)) {
-            DEBUGF("Unsupported ram size: %d bytes (max. supported: %d bytes)\n", cart.ramsize, sizeof(ram));
-        } else {
-            memcpy(ram, src, cart.ramsize);
+        memcpy(ram, src, cart.ramsize);
+        if (cart.has_rtc) {
+            restore_rtc((const rtc_save_t*) (src + cart.ramsize));
         }
     }
+    ram_dirty = 0;
+#ifdef AUTOSAVE
+    prepare_save_log();
+#endif
 
     return cart;
 }
 
 void __not_in_flash_func(loop_launcher)() {
-    DEBUGF("loop_launcher: Waiting for GB to boot...\n");
+    LOOP_DEBUGF("loop_launcher: Waiting for GB to boot...\n");
 
-    while((gpio_get_all64() & GB_RD_PIN_MASK) == 0) {
+    while((gpio_get_all() & GB_RD_PIN_MASK) == 0) {
         tight_loop_contents();
     }
 
+    BUS_EARLY_STATE();
     while (true) {
-        while((gpio_get_all64() & GB_RD_PIN_MASK) != 0) {
-             tight_loop_contents();
+        ROM_PAGING_POLL();
+        uint32_t address;
+        BUS_WAIT_READ(address);
+        if (!BUS_CART_READ(address)) {
+            BUS_WAIT_END();
+            BUS_CYCLE_END();
+            continue;
         }
-        uint32_t address = (gpio_get_all64() & GB_ADDR_PINS_MASK);
         uint8_t data = 0xff;
         if ((address & 0x8000) == 0 && address < cart.romsize) {
-            uint32_t data_location_in_rom = address;
-            SET_DATA(data_location_in_rom);
+            data = BUS_EARLY_READ(address);
         } else if (address >= 0xb000 && address < 0xb400) {
             // Rom entries
             uint16_t offset = address - 0xb000;
@@ -276,201 +1662,225 @@ void __not_in_flash_func(loop_launcher)() {
             // Use a sequence of reads (first 0xbfff, then 0xb40n) to avoid false positives
             if (offset >= 0 && offset < my_roms.count) {
                 selected_rom_addr = my_roms.entries[offset].address;
-                // Break loop, hand it over to main
+                // Complete the cycle, break loop, hand it over to main
+                BUS_DRIVE_DATA(data);
+                BUS_WAIT_END();
                 break;
             }
         } else if (address == 0xbfff) {
             selecting_rom = true;
         }
-        uint64_t data_out = data << GB_DATA_PINS_SHIFT;
-        gpio_set_dir_out_masked64(GB_DATA_PINS_MASK);
-        gpio_put_masked64(GB_DATA_PINS_MASK, data_out);
-        // FIXME when to set back to input ??
-        //gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-        //gpio_clr_mask64(GB_DATA_PINS_MASK);
+        BUS_DRIVE_DATA(data);
+        BUS_WAIT_END();
+        BUS_CYCLE_END();
     }
 }
 
 void __not_in_flash_func(loop_32kb)() {
-    DEBUGF("loop_32kb: Waiting for GB to boot...\n");
+    LOOP_DEBUGF("loop_32kb: Waiting for GB to boot...\n");
 
-    while((gpio_get_all64() & GB_RD_PIN_MASK) == 0) {
+    while((gpio_get_all() & GB_RD_PIN_MASK) == 0) {
         tight_loop_contents();
     }
 
+    BUS_EARLY_STATE();
     while (true) {
-        while((gpio_get_all64() & GB_RD_PIN_MASK) != 0) {
-             tight_loop_contents();
-        }
-        uint32_t address = (gpio_get_all64() & GB_ADDR_PINS_MASK);
-        uint8_t data = 0xff;
-        if ((address & 0x8000) == 0 && address < cart.romsize) {
-            uint32_t data_location_in_rom = address;
-            SET_DATA(data_location_in_rom);
+        ROM_PAGING_POLL();
+        uint32_t address;
+        BUS_WAIT_READ(address);
+        if (!BUS_CART_READ(address)) {
+            BUS_WAIT_END();
+            BUS_CYCLE_END();
+            continue;
         }
-        uint64_t data_out = data << GB_DATA_PINS_SHIFT;
-        gpio_set_dir_out_masked64(GB_DATA_PINS_MASK);
-        gpio_put_masked64(GB_DATA_PINS_MASK, data_out);
-        // FIXME when to set back to input ??
-        //gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-        //gpio_clr_mask64(GB_DATA_PINS_MASK);
+        uint8_t data = BUS_EARLY_READ(address);
+        BUS_DRIVE_DATA(data);
+        BUS_WAIT_END();
+        BUS_CYCLE_END();
     }
 }
 
-void __not_in_flash_func(loop_mbc1)() {
-    uint8_t rombank = 1;
-    uint8_t rambank = 0;
-    bool ram_enabled = false;
+// Mapper loops, instantiated from one source for each feature set. The features are constants in each
+// instance, so the checks for the ones the cart does not have are left out of the hot path. ROMs of
+// mappers are at least 32 KiB, so reads of 0x0000-0x7fff are not checked against the rom size.
+#define MAPPER_MBC1 1
+#define MAPPER_MBC2 2
+#define MAPPER_MBC3 3
+#define MAPPER_MBC5 5
 
-    DEBUGF("loop_mbc1: Waiting for GB to boot...\n");
+// What a write does in each region, as the reads of read_regions
+enum {
+    WRITE_NONE,
+    WRITE_RAM_ENABLE,
+    WRITE_ROM_BANK,         // MBC5: low 8 bits
+    WRITE_ROM_BANK_HIGH,    // MBC5: 9th bit
+    WRITE_RAM_BANK,         // MBC3: or clock register
+    WRITE_CLOCK_LATCH,
+    WRITE_MBC2_REGISTER,    // Ram enable (A8 low) or rom bank (A8 high)
+    WRITE_RAM,
+    WRITE_CLOCK,
+};
 
-    while((gpio_get_all64() & GB_RD_PIN_MASK) == 0) {
-        tight_loop_contents();
+// Cart ram, or a clock register, at 0xa000-0xbfff (open bus when NULL)
+static inline __attribute__((always_inline)) void map_ram_regions(uint8_t* write_regions, uint8_t* window,
+    uint32_t mask, uint8_t write) {
+    for (int i=0; i<2; i++) {
+        map_region(0xa + i, window != NULL ? window + ((i << REGION_SHIFT) & mask) : NULL, mask & REGION_MASK);
+        write_regions[0xa + i] = window != NULL ? write : WRITE_NONE;
     }
+}
 
-    while (true) {
-        while((gpio_get_all64() & GB_CTRL_PINS_MASK) == GB_CTRL_PINS_MASK) {
-             tight_loop_contents();
-        }
-        bool writing = (gpio_get_all64() & GB_WR_PIN_MASK) == 0;
-        uint32_t address = (gpio_get_all64() & GB_ADDR_PINS_MASK);
-        if (writing) {
-            // READ from data pins
-            gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-            gpio_clr_mask64(GB_DATA_PINS_MASK);
-            uint8_t data = (gpio_get_all64() & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT;
-            // Registers: 0x0000-0x1fff to set enable/disable ram
-            if (address <= 0x1fff) {
-                ram_enabled = (data & 0xf) == 0xa;
-            }
-            // Registers: 0x2000-0x3fff to set rom bank
-            else if (address <= 0x3fff) {
-                rombank = (data == 0) ? 1 : (data & 0x1f);  // TODO remove unused bits for small roms ?
-            }
-            // Registers: 0x4000-0x5fff to set ram bank
-            else if (address <= 0x5fff) {
-                rambank = data & 0x03;
-            }
-            // Write to ram
-            else if (ram_enabled && address >= 0xa000 && address <= 0xbfff) {
-                uint32_t data_location_in_ram = (rambank << 13) + (address & 0x1fff);
-                if (data_location_in_ram < cart.ramsize) {
-                    ram[data_location_in_ram] = data;
-                }
-            }
-            continue;
-        }
-        uint8_t data = 0xff;
-        // Read from rom
-        if ((address & 0x8000) == 0 && address < cart.romsize) {
-            uint32_t data_location_in_rom;
-            if ((address & 0xc000) == 0) {
-                // 0x0000-0x3fff: Bank 0
-                data_location_in_rom = address;
-            } else {
-                // 0x4000-0x7fff: Current bank
-                data_location_in_rom = (rombank << 14) + (address & 0x3fff);
-            }
-            SET_DATA(data_location_in_rom);
-        }
-        // Read from ram
-        else if (ram_enabled && address >= 0xa000 && address <= 0xbfff) {
-            uint32_t data_location_in_ram = (rambank << 13) + (address & 0x1fff);
-            if (data_location_in_ram < cart.ramsize) {
-                data = ram[data_location_in_ram];
-            }
-        }
-        uint64_t data_out = data << GB_DATA_PINS_SHIFT;
-        gpio_set_dir_out_masked64(GB_DATA_PINS_MASK);
-        gpio_put_masked64(GB_DATA_PINS_MASK, data_out);
-        // FIXME when to set back to input ??
-        //gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-        //gpio_clr_mask64(GB_DATA_PINS_MASK);
+static inline __attribute__((always_inline)) void map_cart_ram(const int mapper, const bool has_rtc,
+    uint8_t* write_regions, bool ram_enabled, uint8_t select) {
+    if (mapper == MAPPER_MBC2) {
+        map_ram_regions(write_regions, ram_enabled ? ram : NULL, MBC2_RAM_MASK, WRITE_RAM);
+    } else if (has_rtc && select >= RTC_SECONDS) {
+        map_ram_regions(write_regions, rtc_register_window(ram_enabled, select), 0, WRITE_CLOCK);
+    } else {
+        map_ram_regions(write_regions, ram_bank_window(ram_enabled, select), 0x1fff, WRITE_RAM);
     }
 }
 
-void __not_in_flash_func(loop_mbc5)() {
+static inline __attribute__((always_inline)) void mapper_loop(const char* name, const int mapper, const bool has_ram,
+    const bool has_rtc, const bool has_rumble) {
+    const uint16_t bank_mask = rom_bank_mask;
     uint16_t rombank = 1;
-    uint8_t rambank = 0;
+    uint8_t select = 0;     // Ram bank, or clock register (MBC3)
     bool ram_enabled = false;
+    uint8_t latch = 0xff;
+
+    // Registers at 0x0000-0x7fff, cart ram at 0xa000-0xbfff
+    uint8_t write_regions[REGIONS] = { WRITE_NONE };
+    if (mapper == MAPPER_MBC2) {
+        for (int i=0; i<4; i++) {
+            write_regions[i] = WRITE_MBC2_REGISTER;
+        }
+    } else {
+        write_regions[0x0] = write_regions[0x1] = WRITE_RAM_ENABLE;
+        write_regions[0x2] = WRITE_ROM_BANK;
+        write_regions[0x3] = mapper == MAPPER_MBC5 ? WRITE_ROM_BANK_HIGH : WRITE_ROM_BANK;
+        write_regions[0x4] = write_regions[0x5] = WRITE_RAM_BANK;
+        if (has_rtc) {
+            write_regions[0x6] = write_regions[0x7] = WRITE_CLOCK_LATCH;
+        }
+    }
+    map_cart_ram(mapper, has_rtc, write_regions, false, 0);
 
-    DEBUGF("loop_mbc5: Waiting for GB to boot...\n");
+    LOOP_DEBUGF("%s: Waiting for GB to boot...\n", name);
 
-    while((gpio_get_all64() & GB_RD_PIN_MASK) == 0) {
+    while((gpio_get_all() & GB_RD_PIN_MASK) == 0) {
         tight_loop_contents();
     }
 
+    BUS_EARLY_STATE();
     while (true) {
-        while((gpio_get_all64() & GB_CTRL_PINS_MASK) == GB_CTRL_PINS_MASK) {
-             tight_loop_contents();
-        }
-        bool writing = (gpio_get_all64() & GB_WR_PIN_MASK) == 0;
-        uint32_t address = (gpio_get_all64() & GB_ADDR_PINS_MASK);
-        if (writing) {
-            // READ from data pins
-            gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-            gpio_clr_mask64(GB_DATA_PINS_MASK);
-            uint8_t data = (gpio_get_all64() & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT;
-            // Registers: 0x0000-0x1fff to set enable/disable ram
-            if (address <= 0x1fff) {
-                ram_enabled = (data & 0xf) == 0xa;
+        ROM_PAGING_POLL();
+        bool writing;
+        uint32_t address;
+        BUS_WAIT_CYCLE(writing, address);
+        if (!writing) {
+            if (!BUS_CART_READ(address)) {
+                BUS_WAIT_END();
+                BUS_CYCLE_END();
+                continue;
             }
-            // Registers: 0x2000-0x2fff to set low 8 bits of rom bank
-            else if (address <= 0x2fff) {
-                rombank = (rombank & 0x100) | data;
-            }
-            // Registers: 0x3000-0x3fff to set 9th bit of rom bank
-            else if (address <= 0x3fff) {
+            uint8_t data = BUS_EARLY_READ(address);
+            BUS_DRIVE_DATA(data);
+            BUS_WAIT_END();
+            BUS_CYCLE_END();
+            continue;
+        }
+        uint8_t data;
+        BUS_READ_DATA(data);
+        switch (write_regions[address >> REGION_SHIFT]) {
+            case WRITE_RAM_ENABLE:
+                if (has_ram || has_rtc) {
+                    ram_enabled = (data & 0xf) == 0xa;
+                    map_cart_ram(mapper, has_rtc, write_regions, ram_enabled, select);
+                }
+                break;
+            case WRITE_MBC2_REGISTER:
+                if ((address & 0x100) == 0) {
+                    ram_enabled = (data & 0xf) == 0xa;
+                    map_cart_ram(mapper, has_rtc, write_regions, ram_enabled, select);
+                    break;
+                }
+                rombank = (data & 0x0f) == 0 ? 1 : (data & 0x0f);
+                set_rom_bank(rombank & bank_mask);
+                BUS_SET_ROM_BANK();
+                break;
+            case WRITE_ROM_BANK:
+                if (mapper == MAPPER_MBC1) {
+                    rombank = (data == 0) ? 1 : (data & 0x1f);  // TODO remove unused bits for small roms ?
+                } else if (mapper == MAPPER_MBC3) {
+                    rombank = (data & 0x7f) == 0 ? 1 : (data & 0x7f);
+                } else {
+                    rombank = (rombank & 0x100) | data;
+                }
+                set_rom_bank(rombank & bank_mask);
+                BUS_SET_ROM_BANK();
+                break;
+            case WRITE_ROM_BANK_HIGH:
                 rombank = ((data & 0x01) << 8) | (rombank & 0xff);
-            }
-            // Registers: 0x4000-0x5fff to set ram bank
-            else if (address <= 0x5fff) {
-                // If cartridge has a rumble motor, bit 3 of ram bank is used to control it and should _not_ affect selected ram bank
-                if (cart.has_rumble) {
-                    rambank = data & 0x07;
+                set_rom_bank(rombank & bank_mask);
+                BUS_SET_ROM_BANK();
+                break;
+            case WRITE_RAM_BANK:
+                if (mapper == MAPPER_MBC1) {
+                    select = data & 0x03;
+                } else if (has_rumble) {
+                    // Bit 3 of ram bank controls the rumble motor and should _not_ affect selected ram bank
+                    select = data & 0x07;
                 } else {
-                    rambank = data & 0x0f;
+                    select = data & 0x0f;
                 }
-            }
-            // Write to ram
-            else if (ram_enabled && address >= 0xa000 && address <= 0xbfff) {
-                uint32_t data_location_in_ram = (rambank << 13) + (address & 0x1fff);
-                if (data_location_in_ram < cart.ramsize) {
-                    ram[data_location_in_ram] = data;
+                if (has_ram || has_rtc) {
+                    map_cart_ram(mapper, has_rtc, write_regions, ram_enabled, select);
                 }
+                break;
+            case WRITE_CLOCK_LATCH:
+                // 0x00 then 0x01
+                if (latch == 0x00 && data == 0x01) {
+                    latch_rtc();
+                }
+                latch = data;
+                break;
+            case WRITE_RAM: {
+                // MBC2: low 4 bits, stored with the high ones set as read back
+                const read_region_t* region = &read_regions[address >> REGION_SHIFT];
+                write_ram((uint8_t*) region->base + (address & region->mask), mapper == MAPPER_MBC2 ? data | 0xf0 : data);
+                break;
             }
-            continue;
-        }
-        uint8_t data = 0xff;
-        // Read from rom
-        if ((address & 0x8000) == 0 && address < cart.romsize) {
-            uint32_t data_location_in_rom;
-            if ((address & 0xc000) == 0) {
-                // 0x0000-0x3fff: Bank 0
-                data_location_in_rom = address;
-            } else {
-                // 0x4000-0x7fff: Current bank
-                data_location_in_rom = (rombank << 14) + (address & 0x3fff);
-            }
-            SET_DATA(data_location_in_rom);
-        }
-        // Read from ram
-        else if (ram_enabled && address >= 0xa000 && address <= 0xbfff) {
-            uint32_t data_location_in_ram = (rambank << 13) + (address & 0x1fff);
-            if (data_location_in_ram < cart.ramsize) {
-                data = ram[data_location_in_ram];
-            }
+            case WRITE_CLOCK:
+                write_rtc(select, data);
+                break;
         }
-        uint64_t data_out = data << GB_DATA_PINS_SHIFT;
-        gpio_set_dir_out_masked64(GB_DATA_PINS_MASK);
-        gpio_put_masked64(GB_DATA_PINS_MASK, data_out);
-        // FIXME when to set back to input ??
-        //gpio_set_dir_in_masked64(GB_DATA_PINS_MASK);
-        //gpio_clr_mask64(GB_DATA_PINS_MASK);
+        BUS_EARLY_DROP();
+        BUS_WAIT_END();
+        BUS_CYCLE_END();
     }
 }
 
-const char* magic = "pico-gb-rom     ";
+#define MAPPER_LOOP(func_name, mapper, has_ram, has_rtc, has_rumble) \
+    void __not_in_flash_func(func_name)() { \
+        mapper_loop(#func_name, mapper, has_ram, has_rtc, has_rumble); \
+    }
+
+MAPPER_LOOP(loop_mbc1, MAPPER_MBC1, true, false, false)
+MAPPER_LOOP(loop_mbc1_rom_only, MAPPER_MBC1, false, false, false)
+MAPPER_LOOP(loop_mbc2, MAPPER_MBC2, true, false, false)
+MAPPER_LOOP(loop_mbc3, MAPPER_MBC3, true, false, false)
+MAPPER_LOOP(loop_mbc3_rtc, MAPPER_MBC3, true, true, false)
+MAPPER_LOOP(loop_mbc3_rom_only, MAPPER_MBC3, false, false, false)
+MAPPER_LOOP(loop_mbc5, MAPPER_MBC5, true, false, false)
+MAPPER_LOOP(loop_mbc5_rumble, MAPPER_MBC5, true, false, true)
+MAPPER_LOOP(loop_mbc5_rom_only, MAPPER_MBC5, false, false, false)
+
+uint32_t slot_packed_size(const uint8_t* slot) {
+    // 0 for raw slots
+    return slot[20] == SLOT_FORMAT_PACKED ? *((uint32_t*) (slot + 24)) : 0;
+}
+
 uint16_t bsd_checksum(uint8_t* addr, uint32_t size) {
     uint8_t ch;
     uint16_t checksum = 0;
@@ -483,35 +1893,125 @@ uint16_t bsd_checksum(uint8_t* addr, uint32_t size) {
     }
     return checksum;
 }
+
+static bool rom_checksum_matches(uint8_t* addr, uint32_t size) {
+    // Result of a previous boot if the header is the same
+    for (int i=0; i<rom_verified_before.count; i++) {
+        rom_verified_entry_t* entry = &rom_verified_before.entries[i];
+        if (entry->address == (uint32_t) addr && memcmp(entry->header, addr + 16, sizeof(entry->header)) == 0) {
+            DEBUGF("verified by generation %d\n", rom_verified_before.generation);
+            if (rom_verified.count < ROM_VERIFIED_MAX) {
+                rom_verified.entries[rom_verified.count++] = *entry;
+            }
+            return entry->valid;
+        }
+    }
+    uint32_t stored = slot_packed_size(addr) > 0 ? slot_packed_size(addr) : size;
+    bool valid;
+    if (addr[21] == SLOT_CHECKSUM_CRC32) {
+        uint32_t crc = *((uint32_t*) (addr + 28));
+        DEBUGF("crc=0x%08x\n", crc);
+        valid = crc == crc32_dma(0, addr + SLOT_HEADER_LENGTH, stored);
+    } else {
+        uint16_t checksum = *((uint16_t*) (addr + 30));
+        DEBUGF("checksum=0x%04x\n", checksum);
+        valid = checksum == bsd_checksum(addr, stored);
+    }
+    if (rom_verified.count < ROM_VERIFIED_MAX) {
+        rom_verified_entry_t* entry = &rom_verified.entries[rom_verified.count++];
+        entry->address = (uint32_t) addr;
+        entry->valid = valid;
+        memcpy(entry->header, addr + 16, sizeof(entry->header));
+    }
+    return valid;
+}
+
+static bool add_rom_entry(uint8_t* addr, uint8_t* save) {
+    if (my_roms.count >= ROMS_MAX_COUNT) {
+        DEBUGF("too many roms\n");
+        return false;
+    }
+    if (memcmp(addr, magic, 16) != 0) {
+        return false;
+    }
+    // Found magic bytes
+    DEBUGF("found magic\n");
+    uint32_t size = *((uint32_t*) (addr + 16));
+    DEBUGF("size=%d\n", size);
+    if (addr[20] != SLOT_FORMAT_RAW && addr[20] != SLOT_FORMAT_PACKED) {
+        DEBUGF("unknown format 0x%02x\n", addr[20]);
+        return false;
+    }
+    if (addr[21] != SLOT_CHECKSUM_BSD && addr[21] != SLOT_CHECKSUM_CRC32) {
+        DEBUGF("unknown checksum 0x%02x\n", addr[21]);
+        return false;
+    }
+#ifndef ROM_UNPACK
+    if (addr[20] == SLOT_FORMAT_PACKED) {
+        DEBUGF("packed rom not supported by this loader\n");
+        return false;
+    }
+#endif
+    if (size > rom_capacity(header_ram_size(addr + 32))) {
+        DEBUGF("rom too large for this loader, with its ram\n");
+        return false;
+    }
+    if (!rom_checksum_matches(addr, size)) {
+        return false;
+    }
+    // Checksum matches
+    DEBUGF("checksum matches\n");
+    // Read name from rom header
+    int romIndex = my_roms.count;
+    uint8_t* romdata = addr + 32;
+    uint8_t* name = &romdata[0x134];
+    if (strcmp(name, "") != 0) {
+        strncpy(my_roms.entries[romIndex].name, name, 15);
+    } else {
+        strcpy(my_roms.entries[romIndex].name, "ROM ###");
+    }
+    my_roms.entries[romIndex].address = addr;
+    rom_saves[romIndex] = save;
+    my_roms.count++;
+    return true;
+}
+
 void find_rom_entries() {
     DEBUGF("find_rom_entries\n");
-    int romIndex = 0;
-    for (int i=1; i<16; i++) {
-        uint8_t* addr = (uint8_t*) 0x10000000 + i * 0x100000;
-        DEBUGF("addr=0x%08x\n", addr);
-        if (memcmp(addr, magic, 16) == 0) {
-            // Found magic bytes
-            DEBUGF("found magic\n");
-            uint32_t size = *((uint32_t*) (addr + 16));
-            DEBUGF("size=%d\n", size);
-            uint16_t checksum = *((uint16_t*) (addr + 30));
-            DEBUGF("checksum=0x%04x\n", checksum);
-            if (checksum == bsd_checksum(addr, size)) {
-                // Checksum matches
-                DEBUGF("checksum matches\n");
-                // Read name from rom header
-                uint8_t* romdata = addr + 32;
-                uint8_t* name = &romdata[0x134];
-                if (strcmp(name, "") != 0) {
-                    strncpy(my_roms.entries[romIndex].name, name, 15);
-                } else {
-                    strcpy(my_roms.entries[romIndex].name, "ROM ###");
-                }
-                my_roms.entries[romIndex].address = addr;
-                romIndex++;
-            }
+    my_roms.count = 0;
+    memcpy(&rom_verified_before, (const uint8_t*) XIP_BASE + ROM_VERIFIED_OFFSET, sizeof(rom_verified_before));
+    if (memcmp(rom_verified_before.magic, ROM_VERIFIED_MAGIC, 16) != 0 || rom_verified_before.count > ROM_VERIFIED_MAX) {
+        rom_verified_before.generation = 0;
+        rom_verified_before.count = 0;
+    }
+    memset(&rom_verified, 0xff, sizeof(rom_verified));
+    memcpy(rom_verified.magic, ROM_VERIFIED_MAGIC, 16);
+    rom_verified.generation = rom_verified_before.generation + 1;
+    rom_verified.count = 0;
+    // Directory, if any, read in one go
+    memcpy(&rom_dir, (const uint8_t*) XIP_BASE + ROM_DIR_OFFSET, sizeof(rom_dir));
+    if (memcmp(rom_dir.magic, ROM_DIR_MAGIC, 16) == 0 && rom_dir.count <= ROM_DIR_MAX_ENTRIES) {
+        DEBUGF("directory: %d entries\n", rom_dir.count);
+        for (int i=0; i<rom_dir.count; i++) {
+            const rom_dir_entry_t* entry = &rom_dir.entries[i];
+            uint8_t* addr = (uint8_t*) XIP_BASE + entry->offset;
+            DEBUGF("addr=0x%08x\n", addr);
+            add_rom_entry(addr, entry->save_length > 0 ? (uint8_t*) XIP_BASE + entry->save_offset : NULL);
+        }
+    } else {
+        // Fixed 1 MiB slots
+        for (int i=1; i<16; i++) {
+            uint8_t* addr = (uint8_t*) 0x10000000 + i * 0x100000;
+            DEBUGF("addr=0x%08x\n", addr);
+            add_rom_entry(addr, NULL);
         }
     }
-    DEBUGF("find_rom_entries: %d\n", romIndex);
-    my_roms.count = romIndex;
+    DEBUGF("find_rom_entries: %d\n", my_roms.count);
+
+    if (rom_verified.count != rom_verified_before.count
+        || memcmp(rom_verified.entries, rom_verified_before.entries, rom_verified.count * sizeof(rom_verified_entry_t)) != 0) {
+        DEBUGF("Writing verified roms, generation %d\n", rom_verified.generation);
+        flash_range_erase(ROM_VERIFIED_OFFSET, FLASH_SECTOR_SIZE);
+        flash_range_program(ROM_VERIFIED_OFFSET, rom_verified.pages, sizeof(rom_verified.pages));
+    }
 }
\ No newline at end of file
@@ -7,19 +7,39 @@ typedef struct {
     uint8_t rom;
     uint8_t ram;
     uint32_t romsize;
+    uint32_t packed_size;   // Size in flash of a packed rom, 0 if not packed
     uint32_t ramsize;
     bool has_ram;
     bool has_battery;
     bool has_rumble;
+    bool has_rtc;
     void (*loop)();
 } cart_t;
 
-void persist_ram_to_flash();
+// Saves requested by monitor_console (AUTOSAVE)
+typedef enum {
+    SAVE_NONE,
+    SAVE_PERIODIC,
+    SAVE_POWER_OFF,
+} save_trigger_t;
+
+bool persist_ram_to_flash();
+void prepare_save_log();
+save_trigger_t monitor_console(uint64_t now_us, bool active);
 uint8_t* selected_rom();
 void set_selected_rom(uint8_t* selected);
-cart_t init_rom(const uint8_t* romdata, uint32_t size);
+uint32_t slot_packed_size(const uint8_t* slot);
+cart_t init_rom(const uint8_t* romdata, uint32_t size, uint32_t packed_size);
+void init_bus_pio();
 void loop_launcher();
 void loop_32kb();
 void loop_mbc1();
+void loop_mbc1_rom_only();
+void loop_mbc2();
+void loop_mbc3();
+void loop_mbc3_rtc();
+void loop_mbc3_rom_only();
 void loop_mbc5();
+void loop_mbc5_rumble();
+void loop_mbc5_rom_only();
 void find_rom_entries();
@@ -6,3 +6,11 @@
 #else
 #define DEBUGF(...)
 #endif
+
+// Marks the end of a bus cycle in the loops, so the host-side simulator can time each cycle
+#ifdef HOST_SIM
+void sim_cycle_end();
+#define BUS_CYCLE_END() sim_cycle_end()
+#else
+#define BUS_CYCLE_END()
+#endif
@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pico/stdlib.h"
+
+#include "bus.h"
+#include "launcher.h"
+#include "shared/romlist.h"
+#include "sim.h"
+
+// Host-side benchmark for the bus loops of bus.c: feeds scripted Game Boy bus cycles
+// to the selected loop and reports the cost of each class of cycle.
+
+#define SLOT_INDEX 1
+#define SLOT_SIZE (1024*1024)
+#define FLASH_SIZE (16*1024*1024)
+#define SLOT_HEADER_SIZE 32
+
+typedef struct {
+    const char* name;
+    uint8_t type;
+    uint32_t romsize;
+    uint8_t ram;        // Header code of the ram size
+} sim_cart_t;
+
+static const sim_cart_t carts[] = {
+    { "launcher", 0x00, 0, 0 },
+    { "32kb", 0x00, 32*1024, 0 },
+    { "mbc1", 0x03, 512*1024, 2 },
+    { "mbc1-256k", 0x03, 256*1024, 2 },
+    { "mbc2", 0x06, 256*1024, 0 },
+    { "mbc3", 0x10, 256*1024, 3 },
+    { "mbc5", 0x1b, 512*1024, 2 },
+    { "mbc5-256k", 0x1b, 256*1024, 2 },
+    { "mbc5-2m", 0x1b, 2*1024*1024, 2 },
+    { "mbc5-ram32k", 0x1b, 256*1024, 3 },
+    { "mbc5-2m-ram128k", 0x1b, 2*1024*1024, 4 },
+};
+
+static uint32_t seed = 1;
+static FILE* record;
+
+
+static uint32_t next_random() {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint16_t bsd_checksum(const uint8_t* data, uint32_t size) {
+    uint16_t checksum = 0;
+    for (uint32_t i=0; i<size; i++) {
+        checksum = (checksum >> 1) + ((checksum & 1) << 15);
+        checksum += data[i];
+    }
+    return checksum;
+}
+
+static uint8_t* synthetic_rom(const sim_cart_t* cart, uint32_t size) {
+    uint8_t* rom = malloc(size);
+    for (uint32_t i=0; i<size; i++) {
+        // Distinct pattern in each bank
+        rom[i] = (uint8_t) (i * 31 + (i >> 14) * 7);
+    }
+    memcpy(&rom[0x134], "BUS SIM", 8);
+    rom[0x147] = cart->type;
+    rom[0x148] = 0;
+    while ((32*1024 << rom[0x148]) < size) {
+        rom[0x148]++;
+    }
+    rom[0x149] = cart->ram;
+    return rom;
+}
+
+static uint8_t* load_rom(const char* path, uint32_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* rom = malloc(*size);
+    if (fread(rom, 1, *size, f) != *size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    return rom;
+}
+
+// Time spent in init_rom, while main() holds the console in reset, and DMA clocks (LOAD_DMA) in it
+static uint64_t reset_held_ns;
+static uint64_t find_roms_ns;      // find_rom_entries
+static uint64_t load_dma_clocks;
+static uint64_t find_roms_dma_clocks;   // Checksums computed by the sniffer
+static uint32_t cart_ramsize;
+static sim_stats_t persist_stats;       // Flash counters of persist_ram_to_flash, after the run
+static uint32_t persist_at;             // Cycle after which the ram is persisted during the run, 0 if none
+static uint32_t cycles_run;
+static sim_stats_t background_persist_stats;
+static uint32_t load_size;
+
+// Time without cart cycles from a trace, after a number of cycles: the console off (CLK stopped), or
+// running without accessing the cart (e.g. from HRAM)
+#define SIM_QUIET            'Q'
+#define SIM_CLOCKED          'C'
+// Not a gap: the number of saves written so far by AUTOSAVE, checked at that point of the trace
+#define SIM_SAVES            'S'
+#define POLL_US              100     // Monitor polled by core0 during gaps
+typedef struct {
+    uint32_t after;
+    char kind;
+    uint32_t us;        // Count of SIM_SAVES
+} gap_t;
+static gap_t* gaps;
+static uint32_t gap_count;
+static uint32_t next_gap;
+static uint32_t saves_written;      // By AUTOSAVE, with pages programmed
+static uint32_t save_mismatches;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void timed_find_rom_entries() {
+    uint64_t start = now_ns();
+    uint64_t dma_clocks = sim_stats.dma_clocks;
+    find_rom_entries();
+    find_roms_ns = now_ns() - start;
+    find_roms_dma_clocks = sim_stats.dma_clocks - dma_clocks;
+}
+
+static uint8_t* program_slot(int index, const uint8_t* rom, uint32_t size) {
+    // Same layout as tools/loadrom.sh, roms larger than a slot span the next ones
+    uint8_t* slot = (uint8_t*) XIP_BASE + index * SLOT_SIZE;
+    if (index * SLOT_SIZE + SLOT_HEADER_SIZE + size > FLASH_SIZE) {
+        fprintf(stderr, "ROM too large for the flash: %d bytes\n", size);
+        exit(1);
+    }
+    memcpy(slot, "pico-gb-rom     ", 16);
+    memcpy(slot + 16, &size, 4);
+    memset(slot + 20, 0xff, 10);
+    uint16_t checksum = bsd_checksum(rom, size);
+    memcpy(slot + 30, &checksum, 2);
+    memcpy(slot + SLOT_HEADER_SIZE, rom, size);
+    return slot;
+}
+
+static uint8_t* program_slot_image(int index, const char* path, uint32_t* romsize) {
+    // Slot image from tools/packrom.py, raw or packed
+    uint32_t length;
+    uint8_t* image = load_rom(path, &length);
+    uint8_t* slot = (uint8_t*) XIP_BASE + index * SLOT_SIZE;
+    if (length < SLOT_HEADER_SIZE || index * SLOT_SIZE + length > FLASH_SIZE) {
+        fprintf(stderr, "%s: invalid slot image\n", path);
+        exit(1);
+    }
+    memcpy(slot, image, length);
+    memcpy(romsize, slot + 16, 4);
+    free(image);
+    return slot;
+}
+
+extern roms_t my_roms;
+
+static uint8_t* program_flash_image(const char* path, uint32_t* romsize) {
+    // Whole flash (firmware area, directory and roms) from offset 0, boots the first rom listed
+    uint32_t length;
+    uint8_t* image = load_rom(path, &length);
+    if (length > FLASH_SIZE) {
+        fprintf(stderr, "%s: larger than the flash\n", path);
+        exit(1);
+    }
+    memcpy((uint8_t*) XIP_BASE, image, length);
+    free(image);
+    timed_find_rom_entries();
+    if (my_roms.count == 0) {
+        fprintf(stderr, "%s: no rom found\n", path);
+        exit(1);
+    }
+    uint8_t* slot = my_roms.entries[0].address;
+    memcpy(romsize, slot + 16, 4);
+    return slot;
+}
+
+static void add_cycle(sim_cycle_t* cycles, uint32_t* count, char kind, uint16_t address, uint8_t data) {
+    cycles[*count].kind = kind;
+    cycles[*count].address = address;
+    cycles[*count].data = data;
+    cycles[*count].check = false;
+    (*count)++;
+}
+
+static sim_cycle_t* scenario(const char* name, uint32_t romsize, uint32_t ramsize, uint32_t count) {
+    sim_cycle_t* cycles = malloc(count * sizeof(sim_cycle_t));
+    uint32_t banks = romsize > 0x4000 ? romsize / 0x4000 : 2;
+    uint32_t ram_banks = ramsize / 0x2000;
+    uint32_t n = 0;
+    if (strcmp(name, "ram") == 0 || strcmp(name, "save") == 0 || strcmp(name, "mixed") == 0) {
+        // Enable ram
+        add_cycle(cycles, &n, SIM_WRITE, 0x0000, 0x0a);
+    }
+    while (n < count) {
+        uint32_t r = next_random();
+        uint16_t offset = r >> 16;
+        if (strcmp(name, "rom") == 0) {
+            add_cycle(cycles, &n, SIM_READ, offset & 0x7fff, 0);
+        } else if (strcmp(name, "romx") == 0) {
+            if ((n & 0xff) == 0) {
+                add_cycle(cycles, &n, SIM_WRITE, 0x2100, 1 + r % (banks - 1));
+            } else {
+                add_cycle(cycles, &n, SIM_READ, 0x4000 | (offset & 0x3fff), 0);
+            }
+        } else if (strcmp(name, "ram") == 0) {
+            if (ram_banks > 1 && (n & 0xff) == 0) {
+                add_cycle(cycles, &n, SIM_WRITE, 0x4000, r % ram_banks);
+            } else {
+                add_cycle(cycles, &n, (r & 1) ? SIM_READ : SIM_WRITE, 0xa000 | (offset & 0x1fff), r >> 8);
+            }
+        } else if (strcmp(name, "save") == 0) {
+            // Game saving a 512-byte record at the start of the ram, between rom reads
+            if ((n & 0x3f) == 0) {
+                add_cycle(cycles, &n, SIM_WRITE, 0xa000 | ((n >> 6) & 0x1ff), r >> 8);
+            } else {
+                add_cycle(cycles, &n, SIM_READ, offset & 0x7fff, 0);
+            }
+        } else if (strcmp(name, "regs") == 0) {
+            add_cycle(cycles, &n, SIM_WRITE, 0x2100, 1 + r % (banks - 1));
+        } else if (strcmp(name, "mixed") == 0) {
+            uint32_t pick = r % 100;
+            if (pick < 45) {
+                add_cycle(cycles, &n, SIM_READ, offset & 0x3fff, 0);
+            } else if (pick < 88) {
+                add_cycle(cycles, &n, SIM_READ, 0x4000 | (offset & 0x3fff), 0);
+            } else if (pick < 92) {
+                add_cycle(cycles, &n, SIM_READ, 0xa000 | (offset & 0x1fff), 0);
+            } else if (pick < 95) {
+                add_cycle(cycles, &n, SIM_WRITE, 0xa000 | (offset & 0x1fff), r >> 8);
+            } else if (pick < 97) {
+                // WRAM, for the cart to leave alone
+                add_cycle(cycles, &n, SIM_READ, 0xc000 | (offset & 0x1fff), 0);
+            } else {
+                add_cycle(cycles, &n, SIM_WRITE, 0x2100, 1 + r % (banks - 1));
+            }
+        } else {
+            fprintf(stderr, "Unknown scenario: %s\n", name);
+            exit(1);
+        }
+    }
+    return cycles;
+}
+
+static void add_gap(char kind, uint32_t after, uint32_t us) {
+    gaps = realloc(gaps, (gap_count + 1) * sizeof(gap_t));
+    gaps[gap_count].after = after;
+    gaps[gap_count].kind = kind;
+    gaps[gap_count].us = us;
+    gap_count++;
+}
+
+static sim_cycle_t* load_trace(const char* path, uint32_t max, uint32_t* count) {
+    // One cycle per line: "R <address> [<expected data>]" or "W <address> <data>", in hex,
+    // or a gap between cycles: "Q <us>" (console off) or "C <us>" (no cart cycles), in decimal, or "S <count>"
+    // for the saves expected so far
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    uint32_t capacity = 1024;
+    sim_cycle_t* cycles = malloc(capacity * sizeof(sim_cycle_t));
+    char line[128];
+    *count = 0;
+    while (*count < max && fgets(line, sizeof(line), f) != NULL) {
+        char kind;
+        unsigned int address, data;
+        int fields = sscanf(line, " %c %x %x", &kind, &address, &data);
+        if (fields < 2 || kind == '#') {
+            continue;
+        }
+        if (kind == SIM_QUIET || kind == SIM_CLOCKED || kind == SIM_SAVES) {
+            unsigned int us;
+            sscanf(line, " %c %u", &kind, &us);
+            add_gap(kind, *count, us);
+            continue;
+        }
+        if ((kind != SIM_READ && kind != SIM_WRITE) || (kind == SIM_WRITE && fields < 3)) {
+            fprintf(stderr, "%s: invalid cycle: %s", path, line);
+            exit(1);
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            cycles = realloc(cycles, capacity * sizeof(sim_cycle_t));
+        }
+        cycles[*count].kind = kind;
+        cycles[*count].address = address;
+        cycles[*count].data = fields == 3 ? data : 0;
+        cycles[*count].check = kind == SIM_READ && fields == 3;
+        (*count)++;
+    }
+    fclose(f);
+    return cycles;
+}
+
+static void record_cycle(const sim_cycle_t* cycle, bool answered, uint8_t response) {
+    if (cycle->kind == SIM_WRITE) {
+        fprintf(record, "W %04x %02x\n", cycle->address, cycle->data);
+    } else if (answered) {
+        fprintf(record, "R %04x %02x\n", cycle->address, response);
+    } else {
+        fprintf(record, "R %04x\n", cycle->address);
+    }
+}
+
+static void measure_persist(sim_stats_t* stats) {
+    sim_stats_t before = sim_stats;
+    persist_ram_to_flash();
+    stats->sectors_erased = sim_stats.sectors_erased - before.sectors_erased;
+    stats->blocks_erased = sim_stats.blocks_erased - before.blocks_erased;
+    stats->pages_programmed = sim_stats.pages_programmed - before.pages_programmed;
+    stats->flash_busy_us = sim_stats.flash_busy_us - before.flash_busy_us;
+}
+
+#ifdef AUTOSAVE
+static bool after_save;     // First poll after a save
+
+static void monitor(bool active) {
+    // As watch_console, on core0 while the loop keeps running. Its first sample after a save may see CLK in
+    // the same phase as the one before: taken as no edge.
+    if (after_save) {
+        active = false;
+        after_save = false;
+    }
+    uint64_t now_us = sim_time_ns / 1000;
+    save_trigger_t trigger = monitor_console(now_us, active);
+    if (trigger == SAVE_NONE) {
+        return;
+    }
+    sim_stats_t stats = {0};
+    measure_persist(&stats);
+    if (stats.pages_programmed > 0) {
+        saves_written++;
+    }
+    printf("%s after cycle %d (%.1f ms): %d sectors and %d blocks erased, %d pages programmed (~%.1f ms of flash time)",
+        trigger == SAVE_POWER_OFF ? "Power off saved" : "Autosaved", cycles_run, now_us / 1000.0,
+        stats.sectors_erased, stats.blocks_erased, stats.pages_programmed, stats.flash_busy_us / 1000.0);
+    // Next record erased ahead, after the periodic save or by init_rom after power off
+    uint32_t erased = sim_stats.sectors_erased;
+    uint64_t busy_us = sim_stats.flash_busy_us;
+    prepare_save_log();
+    printf(", then %d sectors erased ahead (~%.1f ms)\n", sim_stats.sectors_erased - erased,
+        (sim_stats.flash_busy_us - busy_us) / 1000.0);
+    // Core0 is blocked until the flash is written, the console keeps running
+    sim_time_ns += (stats.flash_busy_us + sim_stats.flash_busy_us - busy_us) * 1000;
+    after_save = true;
+}
+#endif
+
+static void run_gaps() {
+    for (; next_gap < gap_count && gaps[next_gap].after == cycles_run; next_gap++) {
+        if (record) {
+            fprintf(record, "%c %u\n", gaps[next_gap].kind, gaps[next_gap].us);
+        }
+        if (gaps[next_gap].kind == SIM_SAVES) {
+#ifdef AUTOSAVE
+            if (saves_written != gaps[next_gap].us) {
+                printf("After cycle %d: %d saves written, %d expected\n", cycles_run, saves_written,
+                    gaps[next_gap].us);
+                save_mismatches++;
+            }
+#endif
+            continue;
+        }
+#ifdef AUTOSAVE
+        for (uint32_t us=0; us<gaps[next_gap].us; us+=POLL_US) {
+            sim_time_ns += POLL_US * 1000;
+            monitor(gaps[next_gap].kind == SIM_CLOCKED);
+        }
+#else
+        sim_time_ns += gaps[next_gap].us * 1000ull;
+#endif
+    }
+}
+
+static void on_cycle(const sim_cycle_t* cycle, bool answered, uint8_t response) {
+    if (record) {
+        record_cycle(cycle, answered, response);
+    }
+    // Background save (SAVE_BACKGROUND): written by core0 while the loop keeps answering on core1
+    if (++cycles_run == persist_at) {
+        measure_persist(&background_persist_stats);
+    }
+#ifdef AUTOSAVE
+    monitor(true);
+#endif
+    run_gaps();
+}
+
+static void report(const char* cart_name) {
+    printf("%s: roms found in %.1f us, reset released after %.1f us (init_rom)", cart_name,
+        find_roms_ns / 1000.0, reset_held_ns / 1000.0);
+    if (find_roms_dma_clocks > 0) {
+        printf(", checksums in %llu DMA clocks", (unsigned long long) find_roms_dma_clocks);
+    }
+    if (load_dma_clocks > 0) {
+        printf(", %d bytes loaded in %llu DMA clocks (%.2f bytes/clock)", load_size,
+            (unsigned long long) load_dma_clocks, (double) load_size / load_dma_clocks);
+    }
+    printf("\n");
+    printf("%s: %d cycles, %d ignored, %d mismatches, %d bus fights, %d sectors erased, %d pages programmed\n",
+        cart_name, sim_stats.cycles, sim_stats.ignored, sim_stats.mismatches, sim_stats.bus_fights,
+        sim_stats.sectors_erased, sim_stats.pages_programmed);
+#ifdef AUTOSAVE
+    printf("%s: %d saves written, %d not as expected by the trace\n", cart_name, saves_written, save_mismatches);
+#endif
+    if (cart_ramsize > 0 && persist_at > 0) {
+        printf("%s: ram persisted after cycle %d with %d sectors and %d blocks erased, %d pages programmed (~%.1f ms of flash time)\n",
+            cart_name, persist_at, background_persist_stats.sectors_erased, background_persist_stats.blocks_erased,
+            background_persist_stats.pages_programmed, background_persist_stats.flash_busy_us / 1000.0);
+    }
+    if (cart_ramsize > 0) {
+        printf("%s: ram persisted with %d sectors and %d blocks erased, %d pages programmed (~%.1f ms of flash time)\n",
+            cart_name, persist_stats.sectors_erased, persist_stats.blocks_erased, persist_stats.pages_programmed,
+            persist_stats.flash_busy_us / 1000.0);
+    }
+    printf("%-20s %8s %6s", "cycle", "count", "io");
+    for (int i=0; i<sim_counters(); i++) {
+        printf(" %14s %14s", sim_counter_name(i), sim_clocked ? "" : "(to data)");
+    }
+    if (sim_clocked) {
+        printf(" %14s", "bus clocks");
+    }
+    printf("\n");
+    for (int c=0; c<SIM_CLASSES; c++) {
+        sim_class_stats_t* stats = &sim_stats.classes[c];
+        if (stats->count == 0) {
+            continue;
+        }
+        printf("%-20s %8d %6.1f", sim_class_name(c), stats->count, (double) stats->io / stats->count);
+        for (int i=0; i<sim_counters(); i++) {
+            printf(" %14.1f", (double) stats->cost[i] / stats->count);
+            if (c <= SIM_READ_OTHER && !sim_clocked) {
+                printf(" %14.1f", (double) stats->latency[i] / stats->count);
+            } else {
+                printf(" %14s", "-");
+            }
+        }
+        if (sim_clocked) {
+            printf(" %14.1f", (double) stats->clocks / stats->count);
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [-c cart] [-r rom.gb | -i slot.bin | -f flash.bin] [-s scenario | -t trace] [-n cycles] [-o record] [-p cycle]\n"
+        "  -c cart       launcher, 32kb, mbc1, mbc1-256k, mbc2, mbc3, mbc5, mbc5-256k, mbc5-2m, mbc5-ram32k or mbc5-2m-ram128k\n"
+        "                (default: mbc5)\n"
+        "  -r rom.gb     ROM image (default: synthetic ROM matching the cart)\n"
+        "  -i slot.bin   slot image written by tools/packrom.py (raw or packed)\n"
+        "  -f flash.bin  flash image from offset 0, booting the first rom found (see tools/flashdir.py)\n"
+        "  -s scenario   rom, romx, ram, save, regs or mixed (default: mixed)\n"
+        "  -t trace      replay cycles from a trace file, checking reads with an expected value, and the\n"
+        "                console off (\"Q <us>\") or not accessing the cart (\"C <us>\") between them, and the\n"
+        "                saves written so far (\"S <count>\") (AUTOSAVE)\n"
+        "  -n cycles     stop after this many bus cycles (default: 100000)\n"
+        "  -o record     write the observed cycles to a trace file\n"
+        "  -p cycle      persist the ram after this cycle, while the loop keeps running (SAVE_BACKGROUND)\n",
+        argv0);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    const char* cart_name = "mbc5";
+    const char* rom_path = NULL;
+    const char* image_path = NULL;
+    const char* flash_path = NULL;
+    const char* scenario_name = "mixed";
+    const char* trace_path = NULL;
+    const char* record_path = NULL;
+    uint32_t count = 100000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:i:f:s:t:n:o:p:")) != -1) {
+        switch (opt) {
+            case 'c': cart_name = optarg; break;
+            case 'r': rom_path = optarg; break;
+            case 'i': image_path = optarg; break;
+            case 'f': flash_path = optarg; break;
+            case 's': scenario_name = optarg; break;
+            case 't': trace_path = optarg; break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 'o': record_path = optarg; break;
+            case 'p': persist_at = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+
+    const sim_cart_t* cart = NULL;
+    for (int i=0; i<sizeof(carts)/sizeof(carts[0]); i++) {
+        if (strcmp(carts[i].name, cart_name) == 0) {
+            cart = &carts[i];
+        }
+    }
+    if (cart == NULL) {
+        usage(argv[0]);
+    }
+
+    sim_init();
+#ifdef BUS_PIO
+    init_bus_pio();
+#endif
+
+    void (*loop)();
+    uint32_t romsize;
+    if (cart->romsize == 0) {
+        // Launcher, as booted by main()
+        timed_find_rom_entries();
+        romsize = launcher_rom_size;
+        uint64_t start = now_ns();
+        init_rom(launcher_rom, launcher_rom_size, 0);
+        reset_held_ns = now_ns() - start;
+        load_size = launcher_rom_size;
+        loop = &loop_launcher;
+    } else {
+        uint8_t* slot;
+        if (flash_path) {
+            slot = program_flash_image(flash_path, &romsize);
+        } else if (image_path) {
+            slot = program_slot_image(SLOT_INDEX, image_path, &romsize);
+        } else {
+            uint8_t* rom = rom_path ? load_rom(rom_path, &romsize) : synthetic_rom(cart, romsize = cart->romsize);
+            slot = program_slot(SLOT_INDEX, rom, romsize);
+        }
+        timed_find_rom_entries();
+        if (my_roms.count == 0) {
+            fprintf(stderr, "Warning: rom not listed (bad checksum, or too large next to its ram?), loading it anyway\n");
+        }
+        set_selected_rom(slot);
+        uint64_t start = now_ns();
+        cart_t loaded = init_rom(slot + SLOT_HEADER_SIZE, romsize, slot_packed_size(slot));
+        reset_held_ns = now_ns() - start;
+        load_size = romsize;
+        cart_ramsize = loaded.ramsize;
+        loop = loaded.loop;
+        if (loop == NULL) {
+            fprintf(stderr, "Unsupported cartridge: type 0x%02x, %d KiB rom, %d KiB ram\n", loaded.type,
+                romsize / 1024, loaded.ramsize / 1024);
+            return 1;
+        }
+    }
+
+    load_dma_clocks = sim_stats.dma_clocks - find_roms_dma_clocks;
+
+    sim_cycle_t* cycles;
+    if (trace_path) {
+        cycles = load_trace(trace_path, count, &count);
+    } else {
+        cycles = scenario(scenario_name, romsize, cart_ramsize, count);
+    }
+
+    if (record_path) {
+        record = fopen(record_path, "w");
+        if (record == NULL) {
+            perror(record_path);
+            return 1;
+        }
+    }
+    sim_on_cycle = &on_cycle;
+
+    run_gaps();
+    sim_run(loop, cycles, count);
+
+    if (record) {
+        fclose(record);
+    }
+
+    // As on a button press
+    measure_persist(&persist_stats);
+
+    report(cart_name);
+    return sim_stats.mismatches == 0 && sim_stats.bus_fights == 0 && save_mismatches == 0 ? 0 : 1;
+}
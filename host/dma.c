@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+
+#include "sim.h"
+
+// Model of the DMA channels, clocked together with the PIO model (or by each SIO access without it).
+// Reads and writes of a transfer take one clock each; a triggered channel starts on the next clock.
+// Only what bus.c uses: DREQs from the PIO FIFOs, chaining, the register aliases as targets (with null
+// triggers), address rings and the CRC32 sniffer.
+
+typedef struct {
+    bool claimed;
+    dma_channel_config config;
+    uint32_t read_addr;
+    uint32_t write_addr;
+    uint32_t count;
+    uint32_t reload_count;  // Transfer count restored on each trigger
+    bool busy;
+    bool triggered;
+    bool reading;       // Read done, write on the next clock
+    uint32_t value;
+} dma_channel_model_t;
+
+dma_hw_t sim_dma_hw;
+static dma_channel_model_t channels[NUM_DMA_CHANNELS];
+static uint32_t active_channels;    // Busy or triggered, bit per channel
+
+static struct {
+    bool enabled;
+    uint channel;
+    uint mode;
+    bool invert;
+    bool reverse;
+    uint32_t accumulator;
+} sniffer;
+
+// Without the PIO model (host/pio.c), only memory and DMA registers are reachable
+__attribute__((weak)) bool sim_pio_fifo_read(uintptr_t addr, uint32_t* value) {
+    return false;
+}
+
+__attribute__((weak)) bool sim_pio_fifo_write(uintptr_t addr, uint32_t value) {
+    return false;
+}
+
+__attribute__((weak)) bool sim_pio_dreq(unsigned int dreq) {
+    return false;
+}
+
+
+static void trigger(uint channel) {
+    channels[channel].triggered = true;
+    active_channels |= 1u << channel;
+}
+
+static void sniff(uint channel, uint32_t value) {
+    if (!sniffer.enabled || sniffer.channel != channel || !channels[channel].config.sniff_enable) {
+        return;
+    }
+    // As the datasheet: the register shifts left with the IEEE 802.3 polynomial, the data of the transfer
+    // enters MSB first, or LSB first with CRC32R (bit-reversed data)
+    uint bits = 8u << channels[channel].config.size;
+    for (uint i=0; i<bits; i++) {
+        uint bit = sniffer.mode == DMA_SNIFF_CTRL_CALC_VALUE_CRC32R ? i : bits - 1 - i;
+        uint32_t feedback = (sniffer.accumulator >> 31) ^ ((value >> bit) & 1);
+        sniffer.accumulator = (sniffer.accumulator << 1) ^ (0x04c11db7u & -feedback);
+    }
+}
+
+static uint32_t reverse_bits(uint32_t value) {
+    uint32_t reversed = 0;
+    for (int i=0; i<32; i++) {
+        reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    return reversed;
+}
+
+static uint32_t read_value(dma_channel_model_t* ch) {
+    uint32_t value;
+    if (sim_pio_fifo_read(ch->read_addr, &value)) {
+        return value;
+    }
+    switch (ch->config.size) {
+        case DMA_SIZE_8: return *(volatile uint8_t*) (uintptr_t) ch->read_addr;
+        case DMA_SIZE_16: return *(volatile uint16_t*) (uintptr_t) ch->read_addr;
+        default: return *(volatile uint32_t*) (uintptr_t) ch->read_addr;
+    }
+}
+
+static void write_register(uint channel, uint index, uint32_t value) {
+    // Word index in the channel registers: same alias layout as hardware, the last word of each alias triggers
+    dma_channel_model_t* ch = &channels[channel];
+    switch (index) {
+        case 0: case 5: case 10: case 15:
+            ch->read_addr = value;
+            break;
+        case 1: case 6: case 11: case 13:
+            ch->write_addr = value;
+            break;
+        case 2: case 7: case 9: case 14:
+            ch->reload_count = value;
+            break;
+        default:    // CTRL
+            break;
+    }
+    if (index % 4 == 3) {
+        if (value != 0) {
+            trigger(channel);
+        } else if (ch->config.irq_quiet) {
+            // Null trigger
+            sim_dma_hw.intr |= 1u << channel;
+        }
+    }
+}
+
+static void write_value(dma_channel_model_t* ch, uint32_t value) {
+    // Narrow writes are replicated across the bus, as seen by 32-bit registers
+    if (ch->config.size == DMA_SIZE_8) {
+        value = (value & 0xff) * 0x01010101u;
+    } else if (ch->config.size == DMA_SIZE_16) {
+        value = (value & 0xffff) * 0x00010001u;
+    }
+    uintptr_t addr = ch->write_addr;
+    if (addr >= (uintptr_t) &sim_dma_hw.ch[0] && addr < (uintptr_t) &sim_dma_hw.ch[NUM_DMA_CHANNELS]) {
+        uint word = (addr - (uintptr_t) &sim_dma_hw) / 4;
+        write_register(word / 16, word % 16, value);
+        return;
+    }
+    if (sim_pio_fifo_write(addr, value)) {
+        return;
+    }
+    switch (ch->config.size) {
+        case DMA_SIZE_8: *(volatile uint8_t*) addr = value; break;
+        case DMA_SIZE_16: *(volatile uint16_t*) addr = value; break;
+        default: *(volatile uint32_t*) addr = value; break;
+    }
+}
+
+static uint32_t next_addr(uint32_t addr, uint32_t increment, uint ring_size_bits) {
+    if (ring_size_bits == 0) {
+        return addr + increment;
+    }
+    uint32_t mask = (1u << ring_size_bits) - 1;
+    return (addr & ~mask) | ((addr + increment) & mask);
+}
+
+static void dma_clock() {
+    if (active_channels == 0) {
+        return;
+    }
+    sim_stats.dma_clocks++;
+    for (uint c=0; c<NUM_DMA_CHANNELS; c++) {
+        if (channels[c].triggered) {
+            channels[c].triggered = false;
+            channels[c].count = channels[c].reload_count;
+            channels[c].busy = channels[c].count > 0;
+            if (!channels[c].busy) {
+                active_channels &= ~(1u << c);
+            }
+        }
+    }
+    for (uint c=0; c<NUM_DMA_CHANNELS; c++) {
+        dma_channel_model_t* ch = &channels[c];
+        if (!ch->busy) {
+            continue;
+        }
+        if (!ch->reading) {
+            if (ch->config.dreq != DREQ_FORCE && !sim_pio_dreq(ch->config.dreq)) {
+                continue;
+            }
+            ch->value = read_value(ch);
+            sniff(c, ch->value);
+            ch->reading = true;
+            continue;
+        }
+        ch->reading = false;
+        write_value(ch, ch->value);
+        uint32_t size = 1u << ch->config.size;
+        ch->read_addr = next_addr(ch->read_addr, ch->config.read_increment ? size : 0,
+            ch->config.ring_write ? 0 : ch->config.ring_size_bits);
+        ch->write_addr = next_addr(ch->write_addr, ch->config.write_increment ? size : 0,
+            ch->config.ring_write ? ch->config.ring_size_bits : 0);
+        if (--ch->count == 0) {
+            ch->busy = false;
+            active_channels &= ~(1u << c);
+            if (!ch->config.irq_quiet) {
+                sim_dma_hw.intr |= 1u << c;
+            }
+            if (ch->config.chain_to != c) {
+                trigger(ch->config.chain_to);
+            }
+        }
+    }
+}
+
+int dma_claim_unused_channel(bool required) {
+    for (uint c=0; c<NUM_DMA_CHANNELS; c++) {
+        if (!channels[c].claimed) {
+            channels[c].claimed = true;
+            return c;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "No DMA channel available\n");
+        exit(1);
+    }
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config c = {
+        .read_increment = true,
+        .write_increment = false,
+        .dreq = DREQ_FORCE,
+        .chain_to = channel,
+        .size = DMA_SIZE_32,
+    };
+    return c;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+    const volatile void *read_addr, uint transfer_count, bool trigger_now) {
+    dma_channel_model_t* ch = &channels[channel];
+    ch->config = *config;
+    ch->write_addr = (uint32_t) (uintptr_t) write_addr;
+    ch->read_addr = (uint32_t) (uintptr_t) read_addr;
+    ch->reload_count = transfer_count;
+    ch->reading = false;
+    if (trigger_now) {
+        trigger(channel);
+    }
+    sim_dma_clock = &dma_clock;
+}
+
+void dma_channel_start(uint channel) {
+    trigger(channel);
+}
+
+bool dma_channel_is_busy(uint channel) {
+    return channels[channel].busy || channels[channel].triggered;
+}
+
+void dma_channel_abort(uint channel) {
+    active_channels &= ~(1u << channel);
+    channels[channel].busy = false;
+    channels[channel].triggered = false;
+    channels[channel].reading = false;
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    sim_dma_hw.intr &= ~(1u << channel);
+}
+
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable) {
+    if (force_channel_enable) {
+        channels[channel].config.sniff_enable = true;
+    }
+    // The whole control register is written: output inversion and reversal are cleared
+    sniffer.enabled = true;
+    sniffer.channel = channel;
+    sniffer.mode = mode;
+    sniffer.invert = false;
+    sniffer.reverse = false;
+}
+
+void dma_sniffer_disable(void) {
+    sniffer.enabled = false;
+    sniffer.invert = false;
+    sniffer.reverse = false;
+}
+
+void dma_sniffer_set_output_invert_enabled(bool invert) {
+    sniffer.invert = invert;
+}
+
+void dma_sniffer_set_output_reverse_enabled(bool reverse) {
+    sniffer.reverse = reverse;
+}
+
+void dma_sniffer_set_data_accumulator(uint32_t seed_value) {
+    sniffer.accumulator = seed_value;
+}
+
+uint32_t dma_sniffer_get_data_accumulator(void) {
+    // Transformed on the way out only, the seed is written as is
+    uint32_t value = sniffer.reverse ? reverse_bits(sniffer.accumulator) : sniffer.accumulator;
+    return sniffer.invert ? ~value : value;
+}
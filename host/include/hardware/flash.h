@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE         (1u << 8)
+#define FLASH_SECTOR_SIZE       (1u << 12)
+#define FLASH_BLOCK_SIZE        (1u << 16)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
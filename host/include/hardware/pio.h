@@ -0,0 +1,150 @@
+#pragma once
+
+// Host stand-in for the pico-sdk PIO API, backed by the instruction-level PIO model in host/pio.c
+
+#include "pico/stdlib.h"
+
+#define PICO_PIO_VERSION 1
+
+#define NUM_PIO_STATE_MACHINES 4
+
+// FIFO registers, for DMA channels to address them; the state machines live in host/pio.c
+typedef struct {
+    volatile uint32_t txf[NUM_PIO_STATE_MACHINES];
+    volatile uint32_t rxf[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+
+extern pio_hw_t sim_pio_hw[2];
+#define pio0 (&sim_pio_hw[0])
+#define pio1 (&sim_pio_hw[1])
+
+enum pio_src_dest {
+    pio_pins = 0,
+    pio_x = 1,
+    pio_y = 2,
+    pio_null = 3,
+    pio_isr = 6,
+    pio_osr = 7,
+};
+
+typedef struct {
+    uint wrap_target;
+    uint wrap;
+    uint in_base;
+    uint out_base;
+    uint out_count;
+    uint set_base;
+    uint set_count;
+    uint sideset_base;
+    uint sideset_bit_count;
+    bool sideset_optional;
+    uint jmp_pin;
+    bool in_shift_right;
+    bool autopush;
+    uint push_threshold;
+    bool out_shift_right;
+    bool autopull;
+    uint pull_threshold;
+} pio_sm_config;
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+    uint8_t pio_version;
+    uint32_t used_gpio_ranges;
+} pio_program_t;
+
+static inline pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c = { 0 };
+    c.wrap = 31;
+    c.in_shift_right = true;
+    c.out_shift_right = true;
+    return c;
+}
+
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) {
+    c->in_base = in_base;
+}
+
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+static inline void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count) {
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+static inline void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) {
+    c->sideset_base = sideset_base;
+}
+
+static inline void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs) {
+    c->sideset_bit_count = bit_count;
+    c->sideset_optional = optional;
+}
+
+static inline void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) {
+    c->jmp_pin = pin;
+}
+
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold) {
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold;
+}
+
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) {
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold;
+}
+
+static inline void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac) {}
+static inline void sm_config_set_fifo_join(pio_sm_config *c, int join) {}
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_gpio_init(PIO pio, uint pin);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_restart(PIO pio, uint sm);
+
+static inline uint pio_encode_jmp(uint addr) {
+    return addr;
+}
+
+static inline uint pio_encode_pull(bool if_empty, bool block) {
+    return 0x8080 | (if_empty ? 0x40 : 0) | (block ? 0x20 : 0);
+}
+
+static inline uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+    return 0xa000 | (dest << 5) | src;
+}
+
+static inline uint pio_encode_set(enum pio_src_dest dest, uint value) {
+    return 0xe000 | (dest << 5) | value;
+}
+
+// Same numbering as the DREQ_PIOx_TXy / DREQ_PIOx_RXy of the RP2350
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio - sim_pio_hw) * 8 + (is_tx ? 0 : 4) + sm;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// Timer registers read by bus.c, counting the simulated time of the bus (host/sim.c)
+typedef struct {
+    uint32_t timerawh;
+    uint32_t timerawl;
+} timer_hw_t;
+
+timer_hw_t* sim_timer_hw(void);
+#define timer_hw (sim_timer_hw())
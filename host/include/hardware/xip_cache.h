@@ -0,0 +1,5 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+static inline void xip_cache_pin_range(uintptr_t start_offset, uintptr_t size_bytes) {}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Host stand-in for the parts of the pico-sdk used by bus.c, backed by the simulated bus in host/sim.c
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define XIP_BASE                _u(0x10000000)
+#define USBCTRL_DPRAM_BASE      _u(0x50100000)
+
+#define _u(x) x ## u
+
+#define __not_in_flash_func(func_name) func_name
+#define __scratch_x(group)
+
+// Busy waits let the DMA model (host/dma.c) run
+extern void (*sim_dma_clock)();
+static inline void tight_loop_contents(void) {
+    if (sim_dma_clock) {
+        sim_dma_clock();
+    }
+}
+
+uint64_t gpio_get_all64(void);
+uint32_t gpio_get_all(void);
+void gpio_put_masked64(uint64_t mask, uint64_t value);
+void gpio_put_masked(uint32_t mask, uint32_t value);
+void gpio_set_mask64(uint64_t mask);
+void gpio_clr_mask64(uint64_t mask);
+void gpio_clr_mask(uint32_t mask);
+void gpio_set_dir_masked64(uint64_t mask, uint64_t value);
+void gpio_set_dir_out_masked64(uint64_t mask);
+void gpio_set_dir_out_masked(uint32_t mask);
+void gpio_set_dir_in_masked64(uint64_t mask);
+void gpio_set_dir_in_masked(uint32_t mask);
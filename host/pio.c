@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+#include "sim.h"
+
+// Instruction-level model of the PIO blocks, clocked together with the simulated bus.
+// Runs the programs assembled by pioasm; side-set, IRQs and clock dividers are not modelled.
+
+#define PIO_INSTRUCTION_COUNT 32
+#define PIO_FIFO_DEPTH 4
+
+typedef struct {
+    uint32_t entries[PIO_FIFO_DEPTH];
+    uint count;
+} pio_fifo_t;
+
+typedef struct {
+    bool enabled;
+    pio_sm_config config;
+    uint pc;
+    uint32_t x;
+    uint32_t y;
+    uint32_t isr;
+    uint32_t osr;
+    uint isr_count;
+    uint osr_count;
+    uint delay;
+    pio_fifo_t rx;
+    pio_fifo_t tx;
+    bool exec_pending;
+    uint16_t exec_instr;
+} pio_sm_model_t;
+
+typedef struct {
+    uint16_t instructions[PIO_INSTRUCTION_COUNT];
+    uint32_t used;
+    pio_sm_model_t sm[NUM_PIO_STATE_MACHINES];
+} pio_model_t;
+
+pio_hw_t sim_pio_hw[2];
+static pio_model_t pio_models[2];
+
+static inline pio_model_t* model_of(PIO pio) {
+    return &pio_models[pio - sim_pio_hw];
+}
+
+static uint64_t pins_out;
+static uint64_t pins_dir;
+static uint64_t pins_owned;
+
+
+static bool fifo_push(pio_fifo_t* fifo, uint32_t value) {
+    if (fifo->count == PIO_FIFO_DEPTH) {
+        return false;
+    }
+    fifo->entries[fifo->count++] = value;
+    return true;
+}
+
+static bool fifo_pop(pio_fifo_t* fifo, uint32_t* value) {
+    if (fifo->count == 0) {
+        return false;
+    }
+    *value = fifo->entries[0];
+    fifo->count--;
+    for (uint i=0; i<fifo->count; i++) {
+        fifo->entries[i] = fifo->entries[i + 1];
+    }
+    return true;
+}
+
+static uint32_t bit_reverse(uint32_t value) {
+    uint32_t reversed = 0;
+    for (int i=0; i<32; i++) {
+        reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    return reversed;
+}
+
+static void write_pins(uint64_t* pins, uint base, uint count, uint32_t value) {
+    for (uint i=0; i<count; i++) {
+        uint64_t mask = 1ull << ((base + i) % 32);
+        *pins = (value >> i) & 1 ? (*pins | mask) : (*pins & ~mask);
+    }
+}
+
+static void shift_in(pio_sm_model_t* sm, uint32_t data, uint bits) {
+    if (bits == 32) {
+        sm->isr = data;
+    } else {
+        data &= (1u << bits) - 1;
+        sm->isr = sm->config.in_shift_right ? (sm->isr >> bits) | (data << (32 - bits)) : (sm->isr << bits) | data;
+    }
+    sm->isr_count = sm->isr_count + bits > 32 ? 32 : sm->isr_count + bits;
+}
+
+static uint32_t shift_out(pio_sm_model_t* sm, uint bits) {
+    uint32_t data;
+    if (bits == 32) {
+        data = sm->osr;
+        sm->osr = 0;
+    } else if (sm->config.out_shift_right) {
+        data = sm->osr & ((1u << bits) - 1);
+        sm->osr >>= bits;
+    } else {
+        data = sm->osr >> (32 - bits);
+        sm->osr <<= bits;
+    }
+    sm->osr_count = sm->osr_count + bits > 32 ? 32 : sm->osr_count + bits;
+    return data;
+}
+
+static uint32_t source(pio_sm_model_t* sm, uint src, uint64_t pins) {
+    switch (src) {
+        case 0: return (uint32_t) (pins >> sm->config.in_base);
+        case 1: return sm->x;
+        case 2: return sm->y;
+        case 6: return sm->isr;
+        case 7: return sm->osr;
+        default: return 0;  // null, status
+    }
+}
+
+// Executes one instruction, returns false if it stalls
+static bool execute(pio_sm_model_t* sm, uint16_t instr, uint64_t pins, bool* jumped) {
+    uint op = instr >> 13;
+    uint arg1 = (instr >> 5) & 0x7;
+    uint arg2 = instr & 0x1f;
+    uint bits = arg2 == 0 ? 32 : arg2;
+    uint32_t data;
+    switch (op) {
+        case 0: { // JMP
+            bool taken;
+            switch (arg1) {
+                case 0: taken = true; break;
+                case 1: taken = sm->x == 0; break;
+                case 2: taken = sm->x-- != 0; break;
+                case 3: taken = sm->y == 0; break;
+                case 4: taken = sm->y-- != 0; break;
+                case 5: taken = sm->x != sm->y; break;
+                case 6: taken = (pins >> sm->config.jmp_pin) & 1; break;
+                default: taken = sm->osr_count < sm->config.pull_threshold; break;
+            }
+            if (taken) {
+                sm->pc = arg2;
+                *jumped = true;
+            }
+            return true;
+        }
+        case 1: { // WAIT
+            uint polarity = (instr >> 7) & 1;
+            uint src = (instr >> 5) & 0x3;
+            uint index = instr & 0x1f;
+            if (src == 0) {
+                return ((pins >> index) & 1) == polarity;
+            } else if (src == 1) {
+                return ((pins >> ((sm->config.in_base + index) % 32)) & 1) == polarity;
+            }
+            return true;
+        }
+        case 2: // IN
+            if (sm->config.autopush && sm->isr_count + bits >= sm->config.push_threshold && sm->rx.count == PIO_FIFO_DEPTH) {
+                return false;
+            }
+            shift_in(sm, source(sm, arg1, pins), bits);
+            if (sm->config.autopush && sm->isr_count >= sm->config.push_threshold) {
+                fifo_push(&sm->rx, sm->isr);
+                sm->isr = 0;
+                sm->isr_count = 0;
+            }
+            return true;
+        case 3: // OUT
+            if (sm->config.autopull && sm->osr_count >= sm->config.pull_threshold) {
+                if (!fifo_pop(&sm->tx, &sm->osr)) {
+                    return false;
+                }
+                sm->osr_count = 0;
+            }
+            data = shift_out(sm, bits);
+            switch (arg1) {
+                case 0: write_pins(&pins_out, sm->config.out_base, sm->config.out_count, data); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 4: write_pins(&pins_dir, sm->config.out_base, sm->config.out_count, data); break;
+                case 5: sm->pc = data & 0x1f; *jumped = true; break;
+                case 6: sm->isr = data; sm->isr_count = bits; break;
+                case 7: sm->exec_pending = true; sm->exec_instr = data; break;
+            }
+            return true;
+        case 4: { // PUSH / PULL
+            bool conditional = (instr >> 6) & 1;
+            bool block = (instr >> 5) & 1;
+            if ((instr & 0x80) == 0) {
+                if (conditional && sm->isr_count < sm->config.push_threshold) {
+                    return true;
+                }
+                if (sm->rx.count == PIO_FIFO_DEPTH && block) {
+                    return false;
+                }
+                fifo_push(&sm->rx, sm->isr);
+                sm->isr = 0;
+                sm->isr_count = 0;
+            } else {
+                if (conditional && sm->osr_count < sm->config.pull_threshold) {
+                    return true;
+                }
+                if (!fifo_pop(&sm->tx, &sm->osr)) {
+                    if (block) {
+                        return false;
+                    }
+                    sm->osr = sm->x;
+                }
+                sm->osr_count = 0;
+            }
+            return true;
+        }
+        case 5: { // MOV
+            uint mov_op = (instr >> 3) & 0x3;
+            data = source(sm, instr & 0x7, pins);
+            if (mov_op == 1) {
+                data = ~data;
+            } else if (mov_op == 2) {
+                data = bit_reverse(data);
+            }
+            switch (arg1) {
+                case 0: write_pins(&pins_out, sm->config.out_base, sm->config.out_count, data); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 3: write_pins(&pins_dir, sm->config.out_base, sm->config.out_count, data); break;
+                case 4: sm->exec_pending = true; sm->exec_instr = data; break;
+                case 5: sm->pc = data & 0x1f; *jumped = true; break;
+                case 6: sm->isr = data; sm->isr_count = 0; break;
+                case 7: sm->osr = data; sm->osr_count = 0; break;
+            }
+            return true;
+        }
+        case 6: // IRQ
+            return true;
+        default: // SET
+            switch (arg1) {
+                case 0: write_pins(&pins_out, sm->config.set_base, sm->config.set_count, arg2); break;
+                case 1: sm->x = arg2; break;
+                case 2: sm->y = arg2; break;
+                case 4: write_pins(&pins_dir, sm->config.set_base, sm->config.set_count, arg2); break;
+            }
+            return true;
+    }
+}
+
+static void step(pio_model_t* pio, pio_sm_model_t* sm, uint64_t pins) {
+    if (sm->delay > 0) {
+        sm->delay--;
+        return;
+    }
+    bool exec = sm->exec_pending;
+    uint16_t instr = exec ? sm->exec_instr : pio->instructions[sm->pc];
+    sm->exec_pending = false;
+    bool jumped = false;
+    if (!execute(sm, instr, pins, &jumped)) {
+        // Stalled: retry the same instruction on the next clock
+        if (exec) {
+            sm->exec_pending = true;
+        }
+        return;
+    }
+    if (!jumped && !exec) {
+        sm->pc = sm->pc == sm->config.wrap ? sm->config.wrap_target : (sm->pc + 1) % PIO_INSTRUCTION_COUNT;
+    }
+    uint delay_bits = 5 - sm->config.sideset_bit_count;
+    sm->delay = (instr >> 8) & ((1u << delay_bits) - 1);
+}
+
+static void pio_clock() {
+    uint64_t pins = sim_pins();
+    for (int p=0; p<2; p++) {
+        for (int s=0; s<NUM_PIO_STATE_MACHINES; s++) {
+            if (pio_models[p].sm[s].enabled) {
+                step(&pio_models[p], &pio_models[p].sm[s], pins);
+            }
+        }
+    }
+    if (sim_dma_clock) {
+        sim_dma_clock();
+    }
+    sim_pio_drive(pins_out, pins_dir, pins_owned);
+    sim_tick();
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    for (uint offset=0; offset + program->length <= PIO_INSTRUCTION_COUNT; offset++) {
+        uint32_t mask = ((1u << program->length) - 1) << offset;
+        if ((model_of(pio)->used & mask) == 0 && (program->origin < 0 || program->origin == offset)) {
+            for (uint i=0; i<program->length; i++) {
+                uint16_t instr = program->instructions[i];
+                // JMP targets are relative to the program
+                model_of(pio)->instructions[offset + i] = (instr >> 13) == 0 ? instr + offset : instr;
+            }
+            model_of(pio)->used |= mask;
+            return offset;
+        }
+    }
+    fprintf(stderr, "No room for PIO program\n");
+    exit(1);
+}
+
+void pio_gpio_init(PIO pio, uint pin) {
+    pins_owned |= 1ull << pin;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    pio_sm_model_t* model = &model_of(pio)->sm[sm];
+    bool enabled = model->enabled;
+    *model = (pio_sm_model_t) { 0 };
+    model->enabled = enabled;
+    model->config = *config;
+    if (model->config.push_threshold == 0) {
+        model->config.push_threshold = 32;
+    }
+    if (model->config.pull_threshold == 0) {
+        model->config.pull_threshold = 32;
+    }
+    model->pc = initial_pc;
+    model->osr_count = 32;
+    // Make the bus advance with the PIO clock
+    sim_clocked = true;
+    sim_pio_clock = &pio_clock;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    model_of(pio)->sm[sm].enabled = enabled;
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out) {
+    for (uint pin = pin_base; pin < pin_base + pin_count; pin++) {
+        pins_dir = is_out ? (pins_dir | (1ull << pin)) : (pins_dir & ~(1ull << pin));
+    }
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    pio_sm_model_t* model = &model_of(pio)->sm[sm];
+    if (!model->enabled) {
+        // Runs right away, as on hardware (instructions waiting on pins are not supported here)
+        bool jumped = false;
+        execute(model, instr, 0, &jumped);
+        return;
+    }
+    while (model->exec_pending) {
+        pio_clock();
+    }
+    model->exec_pending = true;
+    model->exec_instr = instr;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    model_of(pio)->sm[sm].rx.count = 0;
+    model_of(pio)->sm[sm].tx.count = 0;
+}
+
+void pio_sm_restart(PIO pio, uint sm) {
+    pio_sm_model_t* model = &model_of(pio)->sm[sm];
+    model->isr = 0;
+    model->isr_count = 0;
+    model->osr_count = 32;
+    model->delay = 0;
+    model->exec_pending = false;
+}
+
+// Each access from the CPU takes one clock
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    sim_io_access();
+    pio_clock();
+    return model_of(pio)->sm[sm].rx.count == 0;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    sim_io_access();
+    pio_clock();
+    return model_of(pio)->sm[sm].tx.count == PIO_FIFO_DEPTH;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    uint32_t value = 0;
+    sim_cpu_begin();
+    sim_io_access();
+    fifo_pop(&model_of(pio)->sm[sm].rx, &value);
+    pio_clock();
+    return value;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    while (pio_sm_is_rx_fifo_empty(pio, sm)) {
+        // Clocked by the status read
+    }
+    return pio_sm_get(pio, sm);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    sim_io_access();
+    fifo_push(&model_of(pio)->sm[sm].tx, data);
+    pio_clock();
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    while (pio_sm_is_tx_fifo_full(pio, sm)) {
+        // Clocked by the status read
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+// DMA accesses to the FIFO registers
+
+static pio_sm_model_t* fifo_register(uintptr_t addr, bool* is_tx) {
+    for (int p=0; p<2; p++) {
+        for (int s=0; s<NUM_PIO_STATE_MACHINES; s++) {
+            if (addr == (uintptr_t) &sim_pio_hw[p].txf[s] || addr == (uintptr_t) &sim_pio_hw[p].rxf[s]) {
+                *is_tx = addr == (uintptr_t) &sim_pio_hw[p].txf[s];
+                return &pio_models[p].sm[s];
+            }
+        }
+    }
+    return NULL;
+}
+
+bool sim_pio_fifo_read(uintptr_t addr, uint32_t* value) {
+    bool is_tx;
+    pio_sm_model_t* sm = fifo_register(addr, &is_tx);
+    if (sm == NULL) {
+        return false;
+    }
+    *value = 0;
+    if (!is_tx) {
+        fifo_pop(&sm->rx, value);
+    }
+    return true;
+}
+
+bool sim_pio_fifo_write(uintptr_t addr, uint32_t value) {
+    bool is_tx;
+    pio_sm_model_t* sm = fifo_register(addr, &is_tx);
+    if (sm == NULL) {
+        return false;
+    }
+    if (is_tx) {
+        // Dropped when full, as on hardware
+        fifo_push(&sm->tx, value);
+    }
+    return true;
+}
+
+bool sim_pio_dreq(unsigned int dreq) {
+    pio_sm_model_t* sm = &pio_models[dreq / 8].sm[dreq % 4];
+    return (dreq % 8) < 4 ? sm->tx.count < PIO_FIFO_DEPTH : sm->rx.count > 0;
+}
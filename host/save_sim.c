@@ -0,0 +1,261 @@
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "bus.h"
+#include "sim.h"
+
+// Host-side check of the save log of bus.c on the flash model: power lost in the middle of saves, and the game
+// writing the ram while it is saved. Each reboot must load either the previous save or the new one.
+
+#define SLOT_SIZE (1024*1024)
+#define SLOT_HEADER_SIZE 32
+#define ROM_SIZE (256*1024)
+#define RAM_SIZE 8192
+#define ROMS_COUNT 2
+
+// As in bus.c
+#define SAVE_LOG_OFFSET 0x000be000
+#define SAVE_LOG_SECTORS 64
+
+#define POWER_LOSS_SAVES 400
+
+extern uint8_t* ram;
+extern volatile uint32_t ram_dirty;
+uint32_t crc32_dma(uint32_t crc, const uint8_t* data, uint32_t size);
+
+static uint8_t* slots[ROMS_COUNT];
+static uint32_t seed = 1;
+
+// Flash operations left before the power is cut, -1 for none
+static int power_budget = -1;
+static jmp_buf power_lost;
+static uint32_t erases[16*1024*1024 / FLASH_SECTOR_SIZE];
+
+// Writes of the game during the next saves, one per attempt
+static int ram_writes;
+
+
+static uint32_t next_random() {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static uint16_t bsd_checksum(const uint8_t* data, uint32_t size) {
+    uint16_t checksum = 0;
+    for (uint32_t i=0; i<size; i++) {
+        checksum = (checksum >> 1) + ((checksum & 1) << 15);
+        checksum += data[i];
+    }
+    return checksum;
+}
+
+static uint8_t* program_slot(int index, uint8_t fill) {
+    // MBC5 with 8 KiB of battery-backed ram, its save area at the end of the slot
+    uint8_t* slot = (uint8_t*) XIP_BASE + index * SLOT_SIZE;
+    uint8_t* rom = slot + SLOT_HEADER_SIZE;
+    for (uint32_t i=0; i<ROM_SIZE; i++) {
+        rom[i] = (uint8_t) (i * 31 + fill);
+    }
+    memcpy(&rom[0x134], "SAVE SIM", 8);
+    rom[0x147] = 0x1b;
+    rom[0x148] = 3;
+    rom[0x149] = 2;
+    uint32_t size = ROM_SIZE;
+    memcpy(slot, "pico-gb-rom     ", 16);
+    memcpy(slot + 16, &size, 4);
+    memset(slot + 20, 0xff, 10);
+    uint16_t checksum = bsd_checksum(rom, size);
+    memcpy(slot + 30, &checksum, 2);
+    return slot;
+}
+
+static void boot(int rom) {
+    // As main() after a reset into the rom
+    find_rom_entries();
+    set_selected_rom(slots[rom]);
+    init_rom(slots[rom] + SLOT_HEADER_SIZE, ROM_SIZE, 0);
+}
+
+static void on_flash(uint32_t flash_offs, const uint8_t* data, uint32_t count) {
+    if (data == ram && ram_writes > 0) {
+        // The game writes a byte while the ram is programmed, as the bus loop would record it
+        ram_writes--;
+        ram[100]++;
+        ram_dirty |= 1;
+    }
+    if (power_budget > 0) {
+        power_budget--;
+    } else if (power_budget == 0) {
+        // Cut in the middle: part of the page programmed, or part of the sector erased
+        uint8_t* dest = (uint8_t*) XIP_BASE + flash_offs;
+        if (data != NULL) {
+            for (uint32_t i=0; i<count/2; i++) {
+                dest[i] &= data[i];
+            }
+        } else {
+            memset(dest + 1000, 0xff, 2000);
+        }
+        power_budget = -1;
+        longjmp(power_lost, 1);
+    }
+    if (data == NULL) {
+        for (uint32_t i=0; i<count; i+=FLASH_SECTOR_SIZE) {
+            erases[(flash_offs + i) / FLASH_SECTOR_SIZE]++;
+        }
+    }
+}
+
+static int crc32_vectors() {
+    // The CRC32 of the save log and of the slots, as written by tools/packrom.py with zlib.crc32: whole, and
+    // continued from word-aligned pieces with a byte tail
+    static const struct {
+        const char* data;
+        uint32_t crc;
+    } vectors[] = {
+        { "123456789", 0xcbf43926 },
+        { "The quick brown fox jumps over the lazy dog", 0x414fa339 },
+    };
+    static uint32_t words[16];
+    const uint8_t* data = (const uint8_t*) words;
+    int failures = 0;
+    for (int i=0; i<sizeof(vectors)/sizeof(vectors[0]); i++) {
+        uint32_t length = strlen(vectors[i].data);
+        memcpy(words, vectors[i].data, length);
+        uint32_t whole = crc32_dma(0, data, length);
+        uint32_t continued = crc32_dma(crc32_dma(0, data, 4), data + 4, length - 4);
+        bool ok = whole == vectors[i].crc && continued == vectors[i].crc;
+        printf("crc32: \"%s\" 0x%08x, continued 0x%08x, expected 0x%08x\n", vectors[i].data, whole, continued,
+            vectors[i].crc);
+        failures += !ok;
+    }
+    return failures;
+}
+
+static int power_loss() {
+    // Saves of small changes, mostly of the first rom: those of the second are written back to its save area
+    // when the log wraps over them
+    static uint8_t expected[ROMS_COUNT][RAM_SIZE];
+    static uint8_t next[RAM_SIZE];
+    for (int rom=0; rom<ROMS_COUNT; rom++) {
+        boot(rom);
+        memcpy(expected[rom], ram, RAM_SIZE);
+    }
+    int lost = 0, losses = 0, committed = 0, rolled_back = 0;
+    for (int n=0; n<POWER_LOSS_SAVES; n++) {
+        int rom = next_random() % 40 == 0 ? 1 : 0;
+        boot(rom);
+        if (memcmp(ram, expected[rom], RAM_SIZE) != 0) {
+            printf("save %d: rom %d loaded a wrong save\n", n, rom);
+            lost++;
+        }
+        // Small changes, as games make
+        for (int i=0; i<64; i++) {
+            ram[(n*97 + i*7) % RAM_SIZE] = next_random();
+        }
+        memcpy(next, ram, RAM_SIZE);
+        ram_dirty = 1;
+        power_budget = next_random() % 2 ? next_random() % 40 : -1;
+        if (setjmp(power_lost) == 0) {
+            persist_ram_to_flash();
+            power_budget = -1;
+            memcpy(expected[rom], next, RAM_SIZE);
+            committed++;
+            continue;
+        }
+        losses++;
+        boot(rom);
+        if (memcmp(ram, next, RAM_SIZE) == 0) {
+            // Cut after the commit
+            memcpy(expected[rom], next, RAM_SIZE);
+            committed++;
+        } else if (memcmp(ram, expected[rom], RAM_SIZE) == 0) {
+            rolled_back++;
+        } else {
+            printf("save %d: power loss left a broken save of rom %d\n", n, rom);
+            lost++;
+        }
+    }
+    for (int rom=0; rom<ROMS_COUNT; rom++) {
+        boot(rom);
+        if (memcmp(ram, expected[rom], RAM_SIZE) != 0) {
+            printf("rom %d: wrong save at the end\n", rom);
+            lost++;
+        }
+    }
+    uint32_t log_min = UINT32_MAX, log_max = 0;
+    for (int i=0; i<SAVE_LOG_SECTORS; i++) {
+        uint32_t count = erases[SAVE_LOG_OFFSET / FLASH_SECTOR_SIZE + i];
+        log_min = count < log_min ? count : log_min;
+        log_max = count > log_max ? count : log_max;
+    }
+    uint32_t save_areas = 0;
+    for (int rom=0; rom<ROMS_COUNT; rom++) {
+        for (int i=0; i<RAM_SIZE / FLASH_SECTOR_SIZE; i++) {
+            save_areas += erases[((2 + 2*rom) * SLOT_SIZE - RAM_SIZE) / FLASH_SECTOR_SIZE + i];
+        }
+    }
+    printf("power loss: %d saves, %d power losses (%d rolled back), %d committed, %d lost\n", POWER_LOSS_SAVES,
+        losses, rolled_back, committed, lost);
+    printf("power loss: log sectors erased %d to %d times, %d save area sectors erased (written back)\n",
+        log_min, log_max, save_areas);
+    return lost;
+}
+
+static int ram_written() {
+    // The game writes the ram during 0, 1, 2... attempts of a save, until it is given up
+    static uint8_t previous[RAM_SIZE];
+    static uint8_t current[RAM_SIZE];
+    int failures = 0;
+    boot(0);
+    for (int writes=0; writes<16; writes++) {
+        memcpy(previous, ram, RAM_SIZE);
+        ram[0]++;
+        ram_dirty = 1;
+        ram_writes = writes;
+        bool saved = persist_ram_to_flash();
+        ram_writes = 0;
+        memcpy(current, ram, RAM_SIZE);
+        if (saved) {
+            boot(0);
+            bool ok = memcmp(ram, current, RAM_SIZE) == 0;
+            printf("ram written: %d writes during the save, saved, reloaded %s\n", writes, ok ? "ok" : "WRONG");
+            failures += !ok;
+            continue;
+        }
+        // Left uncommitted: the previous save is loaded, until the last attempt with the console in reset
+        boot(0);
+        bool rolled_back = memcmp(ram, previous, RAM_SIZE) == 0;
+        memcpy(ram, current, RAM_SIZE);
+        ram_dirty = 1;
+        saved = persist_ram_to_flash();
+        boot(0);
+        bool ok = saved && memcmp(ram, current, RAM_SIZE) == 0;
+        printf("ram written: %d writes during the save, given up, reloaded %s, saved in reset %s\n", writes,
+            rolled_back ? "previous" : "WRONG", ok ? "ok" : "WRONG");
+        failures += !rolled_back + !ok;
+        return failures + (writes == 0);
+    }
+    printf("ram written: save never given up\n");
+    return failures + 1;
+}
+
+int main(int argc, char** argv) {
+    sim_init();
+    for (int rom=0; rom<ROMS_COUNT; rom++) {
+        slots[rom] = program_slot(1 + 2*rom, rom);
+    }
+    sim_on_flash = &on_flash;
+
+    int failures = crc32_vectors() + power_loss() + ram_written();
+    printf("%d failures, %d sectors and %d blocks erased, %d pages programmed\n", failures,
+        sim_stats.sectors_erased, sim_stats.blocks_erased, sim_stats.pages_programmed);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,531 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <linux/perf_event.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/timer.h"
+
+#include "pins.h"
+#include "sim.h"
+
+
+// RP2350 memory windows used by bus.c, mapped at their real addresses
+#define SIM_FLASH_SIZE          (16*1024*1024)
+#define SIM_XIP_WINDOW_SIZE     (0x02000000 + 16*1024)     // Flash + pinned cache lines used as banks
+#define SIM_USB_DPRAM_SIZE      (4*1024)
+
+// Clocked bus, for the PIO model: one Game Boy cycle (~954 ns) every SIM_CYCLE_CLOCKS system clocks at 360 MHz
+#define SIM_CYCLE_CLOCKS        344
+#define SIM_STROBE_FALL         60
+#define SIM_STROBE_RISE         300
+
+// Polls with the address settled before the strobe falls
+#define SIM_IDLE_POLLS          1
+// Polls with the strobe down, from the one that sees it fall: the loops answer a read or sample the data of a
+// write in between, then wait for the strobe to rise
+#define SIM_STROBE_POLLS        2
+// Polls from the strobe before a cycle is considered ignored by the loop
+#define SIM_MAX_POLLS           64
+
+sim_stats_t sim_stats;
+uint64_t sim_time_ns;
+void (*sim_on_cycle)(const sim_cycle_t* cycle, bool answered, uint8_t response);
+void (*sim_on_flash)(uint32_t flash_offs, const uint8_t* data, uint32_t count);
+
+static jmp_buf sim_exit;
+
+static const sim_cycle_t* script;
+static uint32_t script_length;
+static uint32_t script_position;
+
+static bool strobe;
+static uint32_t polls;
+static bool answered;
+static bool bus_fight;
+static uint8_t response;
+static uint64_t io_accesses;
+static uint64_t io_at_strobe;
+
+static uint64_t pins_out;
+static uint64_t pins_dir;
+
+// Clocked bus
+bool sim_clocked;
+void (*sim_pio_clock)();
+void (*sim_dma_clock)();
+static uint64_t bus_clock;
+static uint64_t pio_out;
+static uint64_t pio_dir;
+static uint64_t pio_owned;
+static uint64_t data_bus;
+static uint64_t data_bus_changed;
+static uint32_t cpu_position;
+static uint64_t counter_at_cpu[SIM_MAX_COUNTERS];
+static uint64_t io_at_cpu;
+
+static int counter_fd = -1;
+static int counter_count;
+static uint64_t counter_at_strobe[SIM_MAX_COUNTERS];
+static uint64_t counter_at_data[SIM_MAX_COUNTERS];
+static uint64_t counter_overhead[SIM_MAX_COUNTERS];
+
+
+static inline void counter_read(uint64_t* values) {
+    if (counter_fd >= 0) {
+        uint64_t group[1 + SIM_MAX_COUNTERS];
+        if (read(counter_fd, group, sizeof(group)) > 0) {
+            for (int i=0; i<counter_count; i++) {
+                values[i] = group[1 + i];
+            }
+        }
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        values[0] = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+}
+
+static int perf_open(uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void counters_init() {
+    // Prefer hardware instruction and cycle counters, fall back to wall-clock time
+    counter_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS, -1);
+    if (counter_fd >= 0) {
+        counter_count = perf_open(PERF_COUNT_HW_CPU_CYCLES, counter_fd) >= 0 ? 2 : 1;
+    } else {
+        counter_count = 1;
+    }
+    // Calibrate the cost of reading the counters themselves
+    for (int i=0; i<counter_count; i++) {
+        counter_overhead[i] = UINT64_MAX;
+    }
+    for (int n=0; n<1000; n++) {
+        uint64_t before[SIM_MAX_COUNTERS], after[SIM_MAX_COUNTERS];
+        counter_read(before);
+        counter_read(after);
+        for (int i=0; i<counter_count; i++) {
+            if (after[i] - before[i] < counter_overhead[i]) {
+                counter_overhead[i] = after[i] - before[i];
+            }
+        }
+    }
+}
+
+int sim_counters() {
+    return counter_count;
+}
+
+const char* sim_counter_name(int counter) {
+    if (counter_fd < 0) {
+        return "ns";
+    }
+    return counter == 0 ? "instructions" : "cycles";
+}
+
+const char* sim_class_name(int class) {
+    static const char* names[SIM_CLASSES] = {
+        "read rom 0000-3fff",
+        "read rom 4000-7fff",
+        "read ram a000-bfff",
+        "read other",
+        "write register",
+        "write ram a000-bfff",
+        "write other",
+    };
+    return names[class];
+}
+
+static void map_region(uintptr_t base, size_t size) {
+    void* mapped = mmap((void*) base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mapped != (void*) base) {
+        fprintf(stderr, "Unable to map 0x%08lx...0x%08lx\n", base, base + size);
+        exit(1);
+    }
+}
+
+void sim_init() {
+    map_region(XIP_BASE, SIM_XIP_WINDOW_SIZE);
+    map_region(USBCTRL_DPRAM_BASE, SIM_USB_DPRAM_SIZE);
+    // Erased flash
+    memset((uint8_t*) XIP_BASE, 0xff, SIM_FLASH_SIZE);
+    counters_init();
+}
+
+static int classify(const sim_cycle_t* cycle) {
+    bool in_ram = cycle->address >= 0xa000 && cycle->address <= 0xbfff;
+    if (cycle->kind == SIM_WRITE) {
+        return (cycle->address & 0x8000) == 0 ? SIM_WRITE_REG : in_ram ? SIM_WRITE_RAM : SIM_WRITE_OTHER;
+    }
+    if ((cycle->address & 0x8000) == 0) {
+        return (cycle->address & 0x4000) == 0 ? SIM_READ_ROM0 : SIM_READ_ROMX;
+    }
+    return in_ram ? SIM_READ_RAM : SIM_READ_OTHER;
+}
+
+// Pins driven by the cartridge, through SIO or through the PIO model
+static inline uint64_t driven_out() {
+    return (pins_out & ~pio_owned) | (pio_out & pio_owned);
+}
+
+static inline uint64_t driven_dir() {
+    return (pins_dir & ~pio_owned) | (pio_dir & pio_owned);
+}
+
+static uint64_t bus_pins(const sim_cycle_t* cycle, bool strobe) {
+    uint64_t pins = cycle->address | GB_CTRL_PINS_MASK | GB_CS_PIN_MASK;
+    if (strobe) {
+        pins &= ~(cycle->kind == SIM_READ ? GB_RD_PIN_MASK : GB_WR_PIN_MASK);
+        // /CS follows the external ram / wram range
+        if (cycle->address >= 0xa000 && cycle->address < 0xfe00) {
+            pins &= ~GB_CS_PIN_MASK;
+        }
+    }
+    if (cycle->kind == SIM_WRITE && strobe) {
+        pins |= ((uint64_t) cycle->data) << GB_DATA_PINS_SHIFT;
+    } else {
+        // Data bus floats high unless driven by the cartridge
+        pins |= GB_DATA_PINS_MASK & ~driven_dir();
+    }
+    return pins | (driven_out() & driven_dir());
+}
+
+// The console drives D0-D7 on writes, and other devices on reads outside of the cart. Checked when the strobe
+// falls and when the cycle ends, counted once per cycle.
+static void check_bus_fight(const sim_cycle_t* cycle) {
+    if ((cycle->kind == SIM_WRITE || classify(cycle) == SIM_READ_OTHER) && (driven_dir() & GB_DATA_PINS_MASK) != 0) {
+        bus_fight = true;
+    }
+}
+
+static void count_bus_fight() {
+    if (bus_fight) {
+        sim_stats.bus_fights++;
+        bus_fight = false;
+    }
+}
+
+static void end_cycle(bool ignored) {
+    const sim_cycle_t* cycle = &script[script_position];
+    if (ignored) {
+        sim_stats.ignored++;
+    } else {
+        uint64_t now[SIM_MAX_COUNTERS];
+        counter_read(now);
+        sim_class_stats_t* stats = &sim_stats.classes[classify(cycle)];
+        stats->count++;
+        stats->io += io_accesses - io_at_strobe;
+        for (int i=0; i<counter_count; i++) {
+            // Answered reads include an extra counter read
+            uint64_t overhead = counter_overhead[i] * (answered ? 2 : 1);
+            uint64_t cost = now[i] - counter_at_strobe[i];
+            stats->cost[i] += cost > overhead ? cost - overhead : 0;
+            if (answered) {
+                uint64_t latency = counter_at_data[i] - counter_at_strobe[i];
+                stats->latency[i] += latency > counter_overhead[i] ? latency - counter_overhead[i] : 0;
+            }
+        }
+    }
+    if (cycle->kind == SIM_READ && cycle->check && (!answered || response != cycle->data)) {
+        if (sim_stats.mismatches++ < 10) {
+            fprintf(stderr, "Cycle %d: read 0x%04x returned 0x%02x, expected 0x%02x\n", script_position, cycle->address, answered ? response : 0xff, cycle->data);
+        }
+    }
+    if (classify(cycle) == SIM_READ_OTHER && answered) {
+        bus_fight = true;
+    }
+    count_bus_fight();
+    sim_time_ns += SIM_CYCLE_NS;
+    if (sim_on_cycle) {
+        sim_on_cycle(cycle, answered, response);
+    }
+    sim_stats.cycles++;
+    script_position++;
+    strobe = false;
+    polls = 0;
+}
+
+// io counts SIO register accesses, as on the RP2350B: the 64-bit functions access both banks (GPIO 0-31
+// and 32-47), gpio_put_masked reads the outputs before toggling them
+static uint64_t sample_pins() {
+    if (sim_clocked) {
+        uint64_t pins = sim_pins();
+        sim_pio_clock();
+        return pins;
+    }
+    if (sim_dma_clock) {
+        sim_dma_clock();
+    }
+    if (script_position >= script_length) {
+        longjmp(sim_exit, 1);
+    }
+    const sim_cycle_t* cycle = &script[script_position];
+    if (!strobe) {
+        if (polls++ < SIM_IDLE_POLLS) {
+            return bus_pins(cycle, false);
+        }
+        strobe = true;
+        polls = 0;
+        answered = false;
+        io_at_strobe = io_accesses;
+        check_bus_fight(cycle);
+        uint64_t pins = bus_pins(cycle, true);
+        counter_read(counter_at_strobe);
+        return pins;
+    }
+    if (++polls > SIM_MAX_POLLS) {
+        // The loop does not react to this cycle (e.g. a write with a read-only loop)
+        end_cycle(true);
+        return bus_pins(cycle, false);
+    }
+    return bus_pins(cycle, polls < SIM_STROBE_POLLS);
+}
+
+uint64_t gpio_get_all64(void) {
+    io_accesses += 2;
+    return sample_pins();
+}
+
+uint32_t gpio_get_all(void) {
+    io_accesses++;
+    return sample_pins();
+}
+
+static void put_pins(uint64_t mask, uint64_t value) {
+    pins_out = (pins_out & ~mask) | (value & mask);
+    if (strobe && polls < SIM_STROBE_POLLS && !answered && script[script_position].kind == SIM_READ && (mask & pins_dir & GB_DATA_PINS_MASK) == GB_DATA_PINS_MASK) {
+        counter_read(counter_at_data);
+        answered = true;
+        response = (pins_out & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT;
+    }
+}
+
+void gpio_put_masked64(uint64_t mask, uint64_t value) {
+    io_accesses += 4;
+    put_pins(mask, value);
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value) {
+    io_accesses += 2;
+    put_pins(mask, value);
+}
+
+void gpio_set_mask64(uint64_t mask) {
+    io_accesses += 2;
+    pins_out |= mask;
+}
+
+void gpio_clr_mask64(uint64_t mask) {
+    io_accesses += 2;
+    pins_out &= ~mask;
+}
+
+void gpio_clr_mask(uint32_t mask) {
+    io_accesses++;
+    pins_out &= ~(uint64_t) mask;
+}
+
+void gpio_set_dir_masked64(uint64_t mask, uint64_t value) {
+    io_accesses += 2;
+    pins_dir = (pins_dir & ~mask) | (value & mask);
+}
+
+void gpio_set_dir_out_masked64(uint64_t mask) {
+    io_accesses += 2;
+    pins_dir |= mask;
+}
+
+void gpio_set_dir_out_masked(uint32_t mask) {
+    io_accesses++;
+    pins_dir |= mask;
+}
+
+void gpio_set_dir_in_masked64(uint64_t mask) {
+    io_accesses += 2;
+    pins_dir &= ~mask;
+}
+
+void gpio_set_dir_in_masked(uint32_t mask) {
+    io_accesses++;
+    pins_dir &= ~(uint64_t) mask;
+}
+
+static int cycle_phase() {
+    return bus_clock % SIM_CYCLE_CLOCKS;
+}
+
+uint64_t sim_pins() {
+    if (script == NULL) {
+        // Set-up before sim_run(): idle bus
+        return GB_ADDR_PINS_MASK | GB_CTRL_PINS_MASK | GB_CS_PIN_MASK | (GB_DATA_PINS_MASK & ~driven_dir());
+    }
+    uint32_t position = bus_clock / SIM_CYCLE_CLOCKS;
+    if (position >= script_length) {
+        longjmp(sim_exit, 1);
+    }
+    bool strobe = cycle_phase() >= SIM_STROBE_FALL && cycle_phase() < SIM_STROBE_RISE;
+    return bus_pins(&script[position], strobe);
+}
+
+void sim_pio_drive(uint64_t out, uint64_t dir, uint64_t owned) {
+    pio_out = out;
+    pio_dir = dir;
+    pio_owned = owned;
+}
+
+static void end_clocked_cycle() {
+    const sim_cycle_t* cycle = &script[script_position];
+    sim_class_stats_t* stats = &sim_stats.classes[classify(cycle)];
+    stats->count++;
+    if (cycle->kind == SIM_READ) {
+        // The console latches the data bus when /RD rises
+        answered = (driven_dir() & GB_DATA_PINS_MASK) == GB_DATA_PINS_MASK;
+        response = (driven_out() & GB_DATA_PINS_MASK) >> GB_DATA_PINS_SHIFT;
+        if (answered) {
+            stats->clocks += data_bus_changed - (bus_clock - SIM_STROBE_RISE + SIM_STROBE_FALL);
+        } else if (classify(cycle) != SIM_READ_OTHER) {
+            sim_stats.ignored++;
+        }
+    }
+    check_bus_fight(cycle);
+    count_bus_fight();
+    if (cycle->kind == SIM_READ && cycle->check && (!answered || response != cycle->data)) {
+        if (sim_stats.mismatches++ < 10) {
+            fprintf(stderr, "Cycle %d: read 0x%04x returned 0x%02x, expected 0x%02x\n", script_position, cycle->address, answered ? response : 0xff, cycle->data);
+        }
+    }
+    sim_time_ns += SIM_CYCLE_NS;
+    if (sim_on_cycle) {
+        sim_on_cycle(cycle, answered, response);
+    }
+    sim_stats.cycles++;
+}
+
+void sim_tick() {
+    if (script == NULL) {
+        return;
+    }
+    uint64_t data = (driven_out() & GB_DATA_PINS_MASK) | ((driven_dir() & GB_DATA_PINS_MASK) << 32);
+    if (data != data_bus) {
+        data_bus = data;
+        data_bus_changed = bus_clock;
+    }
+    bus_clock++;
+    script_position = bus_clock / SIM_CYCLE_CLOCKS;
+    if (cycle_phase() == SIM_STROBE_FALL) {
+        data_bus_changed = bus_clock;
+        if (script_position < script_length) {
+            check_bus_fight(&script[script_position]);
+        }
+    } else if (cycle_phase() == SIM_STROBE_RISE) {
+        end_clocked_cycle();
+    }
+}
+
+void sim_cpu_begin() {
+    cpu_position = script_position;
+    io_at_cpu = io_accesses;
+    counter_read(counter_at_cpu);
+}
+
+void sim_io_access() {
+    io_accesses++;
+}
+
+void sim_cycle_end() {
+    if (sim_clocked) {
+        // CPU share of the cycle, from the FIFO word to the end of its handling
+        uint64_t now[SIM_MAX_COUNTERS];
+        counter_read(now);
+        const sim_cycle_t* cycle = &script[cpu_position];
+        sim_class_stats_t* stats = &sim_stats.classes[classify(cycle)];
+        stats->io += io_accesses - io_at_cpu;
+        for (int i=0; i<counter_count; i++) {
+            uint64_t cost = now[i] - counter_at_cpu[i];
+            stats->cost[i] += cost > counter_overhead[i] ? cost - counter_overhead[i] : 0;
+        }
+        if (cycle->kind == SIM_WRITE) {
+            stats->clocks += bus_clock - (cpu_position * SIM_CYCLE_CLOCKS + SIM_STROBE_FALL);
+        }
+    } else if (strobe) {
+        end_cycle(false);
+    }
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    assert(flash_offs % FLASH_SECTOR_SIZE == 0 && count % FLASH_SECTOR_SIZE == 0);
+    assert(flash_offs + count <= SIM_FLASH_SIZE);
+    // As the bootrom: a block erase for each aligned 64 KiB, sector erases otherwise
+    while (count > 0) {
+        bool block = flash_offs % FLASH_BLOCK_SIZE == 0 && count >= FLASH_BLOCK_SIZE;
+        uint32_t length = block ? FLASH_BLOCK_SIZE : FLASH_SECTOR_SIZE;
+        if (sim_on_flash) {
+            sim_on_flash(flash_offs, NULL, length);
+        }
+        memset((uint8_t*) XIP_BASE + flash_offs, 0xff, length);
+        if (block) {
+            sim_stats.blocks_erased++;
+            sim_stats.flash_busy_us += SIM_FLASH_BLOCK_ERASE_US;
+        } else {
+            sim_stats.sectors_erased++;
+            sim_stats.flash_busy_us += SIM_FLASH_SECTOR_ERASE_US;
+        }
+        flash_offs += length;
+        count -= length;
+    }
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    assert(flash_offs % FLASH_PAGE_SIZE == 0 && count % FLASH_PAGE_SIZE == 0);
+    assert(flash_offs + count <= SIM_FLASH_SIZE);
+    uint8_t* dest = (uint8_t*) XIP_BASE + flash_offs;
+    for (size_t page=0; page<count; page+=FLASH_PAGE_SIZE) {
+        if (sim_on_flash) {
+            sim_on_flash(flash_offs + page, data + page, FLASH_PAGE_SIZE);
+        }
+        // Programming can only clear bits
+        for (size_t i=page; i<page+FLASH_PAGE_SIZE; i++) {
+            dest[i] &= data[i];
+        }
+        sim_stats.pages_programmed++;
+        sim_stats.flash_busy_us += SIM_FLASH_PAGE_PROGRAM_US;
+    }
+}
+
+timer_hw_t* sim_timer_hw(void) {
+    static timer_hw_t timer;
+    uint64_t us = sim_time_ns / 1000;
+    timer.timerawh = us >> 32;
+    timer.timerawl = (uint32_t) us;
+    return &timer;
+}
+
+void sim_run(void (*loop)(), const sim_cycle_t* cycles, uint32_t count) {
+    script = cycles;
+    script_length = count;
+    script_position = 0;
+    strobe = false;
+    polls = 0;
+    bus_clock = 0;
+    if (setjmp(sim_exit) == 0) {
+        loop();
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Scripted Game Boy bus driving the bus loops of bus.c on a host machine
+
+#define SIM_READ             'R'
+#define SIM_WRITE            'W'
+
+#define SIM_MAX_COUNTERS     2
+
+// Machine cycle of the console (1.048576 MHz), the simulated time of each bus cycle
+#define SIM_CYCLE_NS         954
+
+// Typical erase and program times of the QSPI NOR flash (W25Q series)
+#define SIM_FLASH_SECTOR_ERASE_US   45000
+#define SIM_FLASH_BLOCK_ERASE_US    150000
+#define SIM_FLASH_PAGE_PROGRAM_US   400
+
+typedef struct {
+    char kind;          // SIM_READ or SIM_WRITE
+    uint16_t address;
+    uint8_t data;       // Byte written by the console, or expected response to a read
+    bool check;         // Compare the response to a read against data
+} sim_cycle_t;
+
+enum {
+    SIM_READ_ROM0,      // 0x0000-0x3fff
+    SIM_READ_ROMX,      // 0x4000-0x7fff
+    SIM_READ_RAM,       // 0xa000-0xbfff
+    SIM_READ_OTHER,
+    SIM_WRITE_REG,      // 0x0000-0x7fff
+    SIM_WRITE_RAM,      // 0xa000-0xbfff
+    SIM_WRITE_OTHER,
+    SIM_CLASSES
+};
+
+typedef struct {
+    uint32_t count;
+    uint64_t io;                            // SIO or FIFO accesses from strobe to end of cycle
+    uint64_t cost[SIM_MAX_COUNTERS];        // Counter deltas from strobe to end of cycle
+    uint64_t latency[SIM_MAX_COUNTERS];     // Counter deltas from strobe to data driven (reads only)
+    uint64_t clocks;                        // Clocked bus: strobe to data driven (reads) or handled (writes)
+} sim_class_stats_t;
+
+typedef struct {
+    sim_class_stats_t classes[SIM_CLASSES];
+    uint32_t cycles;
+    uint32_t ignored;                       // Cycles the loop never answered
+    uint32_t mismatches;
+    uint32_t bus_fights;                    // D0-D7 driven on writes, or on reads outside of the cart
+    uint32_t sectors_erased;
+    uint32_t blocks_erased;                 // 64 KiB
+    uint32_t pages_programmed;
+    uint64_t flash_busy_us;                 // Erase and program time, at typical QSPI NOR flash timings
+    uint64_t dma_clocks;                    // Clocks with a DMA channel active
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+// Time of the bus, for the timer: SIM_CYCLE_NS per cycle, plus time without cycles
+extern uint64_t sim_time_ns;
+
+// Called after each cycle with the byte driven by the cartridge (reads only)
+extern void (*sim_on_cycle)(const sim_cycle_t* cycle, bool answered, uint8_t response);
+
+// Called before each sector or block erase (data NULL) and each page program of the flash model. May do part of
+// it and leave with longjmp, as a power loss would
+extern void (*sim_on_flash)(uint32_t flash_offs, const uint8_t* data, uint32_t count);
+
+void sim_init();
+int sim_counters();
+const char* sim_counter_name(int counter);
+const char* sim_class_name(int class);
+
+// Clocked bus, advanced one system clock at a time by the PIO model (host/pio.c)
+extern bool sim_clocked;
+extern void (*sim_pio_clock)();
+uint64_t sim_pins();
+void sim_pio_drive(uint64_t out, uint64_t dir, uint64_t owned);
+void sim_tick();
+// The CPU got the FIFO word of the current cycle
+void sim_cpu_begin();
+void sim_io_access();
+
+// DMA model (host/dma.c), clocked by the PIO model
+extern void (*sim_dma_clock)();
+bool sim_pio_fifo_read(uintptr_t addr, uint32_t* value);
+bool sim_pio_fifo_write(uintptr_t addr, uint32_t value);
+bool sim_pio_dreq(unsigned int dreq);
+
+// Runs loop against cycles[0..count), returns when the script is exhausted or when the loop returns
+void sim_run(void (*loop)(), const sim_cycle_t* cycles, uint32_t count);
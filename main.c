@@ -3,6 +3,15 @@
 #include "hardware/vreg.h"
 #include "hardware/watchdog.h"
 
+#ifdef BUS_CORE1
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+#endif
+
+#ifdef SAVE_BACKGROUND
+#include "pico/flash.h"
+#endif
+
 #include "debug.h"
 #include "bus.h"
 #include "pins.h"
@@ -11,18 +20,60 @@
 #define OVERCLOCK_FREQ_MHZ 360
 #define MAGIC_RESET_TO_ROM 0x11111111
 
-void button_gpio_callback(uint gpio, uint32_t events) {
-    // Called when BUTTON is pressed (low)
-    // Wait for BUTTON to be released (high) or for the long-press reset-to-launcher timeout
-    uint32_t counter = 1000000;
-    while (--counter && !gpio_get(BUTTON_PIN)) {
-        tight_loop_contents();
+#ifdef BUS_CORE1
+// Written by core0 before launching core1
+static void (*volatile core1_loop)();
+// Written by core1 only
+static volatile bool core1_loop_returned;
+
+static void __not_in_flash_func(core1_entry)() {
+    // Nothing but the bus on this core: no interrupts, code in RAM, stack in scratch X
+    save_and_disable_interrupts();
+    core1_loop();
+    core1_loop_returned = true;
+    while (true) {
+        __wfe();
     }
+}
+#endif
 
-    // Persist ram to flash, if needed
-    persist_ram_to_flash();
+#ifdef SAVE_BACKGROUND
+// Set by the button interrupt: core0 persists the ram and resets, while the game keeps running on core1
+static volatile bool save_requested;
+static volatile bool save_to_launcher;
+static void save_and_reset();
+#endif
 
-    if (counter == 0 || selected_rom() == 0) {
+#ifdef AUTOSAVE
+static void watch_console();
+#endif
+
+// Runs the loop until it returns (i.e. launcher), on core1 in dual-core mode
+static void run_loop(void (*loop)()) {
+#ifdef BUS_CORE1
+    core1_loop = loop;
+    core1_loop_returned = false;
+    multicore_launch_core1(core1_entry);
+    // Button, saving and logging stay on core0
+    while (!core1_loop_returned) {
+#ifdef SAVE_BACKGROUND
+        if (save_requested) {
+            save_and_reset();
+        }
+#endif
+#ifdef AUTOSAVE
+        watch_console();
+#endif
+        tight_loop_contents();
+    }
+    multicore_reset_core1();
+#else
+    loop();
+#endif
+}
+
+static void reset_rp2350(bool to_launcher) {
+    if (to_launcher) {
         // Just reset RP2350 (into launcher)
         DEBUGF("Resetting to launcher\n");
         watchdog_hw->scratch[0] = 0;
@@ -37,6 +88,86 @@ void button_gpio_callback(uint gpio, uint32_t events) {
     }
 }
 
+#ifdef SAVE_BACKGROUND
+static void persist_ram(void* saved) {
+    *((bool*) saved) = persist_ram_to_flash();
+}
+
+static void save_and_reset() {
+    // Core1 runs from RAM only, it is left running while flash is written
+    bool saved = false;
+    flash_safe_execute(&persist_ram, &saved, UINT32_MAX);
+    if (!saved) {
+        // The game kept writing the ram, stop the console for a last attempt
+        gpio_set_dir(GB_RESET_PIN, true);
+        flash_safe_execute(&persist_ram, &saved, UINT32_MAX);
+    }
+    multicore_reset_core1();
+    reset_rp2350(save_to_launcher);
+}
+#endif
+
+#ifdef AUTOSAVE
+static void autosave_ram(void* saved) {
+    *((bool*) saved) = persist_ram_to_flash();
+    prepare_save_log();
+}
+
+static void watch_console() {
+    // Running while CLK toggles between two polls with /RESET high
+    static uint64_t last_pins;
+    uint64_t pins = gpio_get_all64();
+    bool active = ((pins ^ last_pins) & GB_CLK_PIN_MASK) && (pins & GB_RESET_PIN_MASK);
+    last_pins = pins;
+
+    bool saved = false;
+    switch (monitor_console(time_us_64(), active)) {
+        case SAVE_PERIODIC:
+            // Left dirty if the game wrote the ram meanwhile, for the next one
+            flash_safe_execute(&autosave_ram, &saved, UINT32_MAX);
+            // CLK is compared with a sample from after the save
+            last_pins = gpio_get_all64();
+            monitor_console(time_us_64(), true);
+            break;
+        case SAVE_POWER_OFF:
+            // The log sectors were erased ahead, only the pages of the record are programmed before the
+            // power is gone (the next ones are erased by init_rom)
+            DEBUGF("Console turned off\n");
+            flash_safe_execute(&persist_ram, &saved, UINT32_MAX);
+            multicore_reset_core1();
+            reset_rp2350(false);
+            break;
+        default:
+            break;
+    }
+}
+#endif
+
+void button_gpio_callback(uint gpio, uint32_t events) {
+    // Called when BUTTON is pressed (low)
+    // Wait for BUTTON to be released (high) or for the long-press reset-to-launcher timeout
+    uint32_t counter = 1000000;
+    while (--counter && !gpio_get(BUTTON_PIN)) {
+        tight_loop_contents();
+    }
+
+#ifdef SAVE_BACKGROUND
+    // Out of the interrupt, the game keeps running until the save is written
+    save_to_launcher = counter == 0 || selected_rom() == 0;
+    save_requested = true;
+#else
+#ifdef BUS_CORE1
+    // Waiting for the button no longer stalls the bus, stop it only to write flash
+    multicore_reset_core1();
+#endif
+
+    // Persist ram to flash, if needed
+    persist_ram_to_flash();
+
+    reset_rp2350(counter == 0 || selected_rom() == 0);
+#endif
+}
+
 
 int main() {
     // Overclock to 360MHz
@@ -71,6 +202,11 @@ int main() {
     gpio_set_slew_rate(GB_DATA_PINS_SHIFT+6, GPIO_SLEW_RATE_FAST);
     gpio_set_slew_rate(GB_DATA_PINS_SHIFT+7, GPIO_SLEW_RATE_FAST);
 
+#ifdef BUS_PIO
+    // Hand A0-A15, D0-D7, /RD and /WR over to the PIO bus front-end
+    init_bus_pio();
+#endif
+
     // Hold console in reset until rom is loaded and loop is started
     gpio_put(GB_RESET_PIN, 0);
     gpio_set_drive_strength(GB_RESET_PIN, GPIO_DRIVE_STRENGTH_12MA);
@@ -86,6 +222,11 @@ int main() {
     irq_set_enabled(IO_IRQ_BANK0, true);
     gpio_set_irq_enabled(BUTTON_PIN, GPIO_IRQ_EDGE_FALL, true);
 
+#ifdef AUTOSAVE
+    // Watched for console power off
+    gpio_init(GB_CLK_PIN);
+#endif
+
     uint8_t* selected;
     if (watchdog_hw->scratch[0] == MAGIC_RESET_TO_ROM) {
         selected = (uint8_t*) watchdog_hw->scratch[1];
@@ -95,12 +236,12 @@ int main() {
         DEBUGF("Booting to launcher\n");
 
         // Load menu and loop
-        init_rom(launcher_rom, launcher_rom_size);
+        init_rom(launcher_rom, launcher_rom_size, 0);
 
         // Release reset on console
         gpio_set_dir(GB_RESET_PIN, false);
 
-        loop_launcher();
+        run_loop(&loop_launcher);
 
         // Rom was selected, load and run loop
         selected = selected_rom();
@@ -111,14 +252,17 @@ int main() {
         gpio_set_dir(GB_RESET_PIN, true);
 
         uint32_t size = *((uint32_t*) (selected + 16));
-        cart_t cart = init_rom(selected + 32, size);
-        
-        // Release reset on console
-        gpio_set_dir(GB_RESET_PIN, false);
+        cart_t cart = init_rom(selected + 32, size, slot_packed_size(selected));
+        if (cart.loop == NULL) {
+            // Unsupported (e.g. too large next to its ram): back to the launcher, the console still in reset
+            DEBUGF("Unsupported rom\n");
+            reset_rp2350(true);
+        } else {
+            // Release reset on console
+            gpio_set_dir(GB_RESET_PIN, false);
 
-        // FIXME Stop loop if console is turned off ? --> 5v from cartridge header ? rst ?        
-        
-        cart.loop();
+            run_loop(cart.loop);
+        }
     }
 #endif
 
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+# Checks a linked firmware for calls into flash from the code core1 runs while core0 writes the flash: the bus
+# loops and core1_entry, then everything they branch to (directly, or through linker veneers) must be in RAM.
+# Indirect calls (blx through a register) are not followed.
+
+import re, subprocess, sys, getopt
+
+ROOTS = re.compile(r'^(loop_\w+|core1_entry)$')
+VENEER = re.compile(r'^__(\w+)_veneer$')
+# "10000234:	bl	0x1000037c <name+0x4>", as GNU and LLVM objdump print it without the raw instruction
+BRANCH = re.compile(r'^\s*[0-9a-f]+:\s+(?:b[a-z]*(?:\.[nw])?|cbn?z)\s+(?:\w+,\s*)?(?:0x)?([0-9a-f]+)\s+<([^>+]+)')
+
+
+def usage():
+    print('Usage: check_ram_loops.py [--nm nm] [--objdump objdump] [--flash start:end] firmware.elf',
+          file=sys.stderr)
+    sys.exit(2)
+
+
+def symbols(nm, elf):
+    # name -> (address without the Thumb bit, size) of the functions
+    out = subprocess.run([nm, '-S', '--defined-only', elf], check=True, capture_output=True, text=True).stdout
+    functions = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in 'tTwW':
+            functions[fields[3]] = (int(fields[0], 16) & ~1, int(fields[1], 16))
+    return functions
+
+
+def branches(objdump, elf, start, size):
+    out = subprocess.run([objdump, '-d', '--no-show-raw-insn', '--start-address=0x%x' % start,
+                          '--stop-address=0x%x' % (start + size), elf],
+                         check=True, capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        match = BRANCH.match(line)
+        if match:
+            target = int(match.group(1), 16)
+            if not start <= target < start + size:
+                yield target, match.group(2)
+
+
+def chain(callers, name):
+    # name, its caller... up to the loop
+    names = [name]
+    while callers[names[-1]] is not None:
+        names.append(callers[names[-1]])
+    return names
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], '', ['nm=', 'objdump=', 'flash='])
+    except getopt.GetoptError:
+        usage()
+    if len(args) != 1:
+        usage()
+    nm, objdump = 'arm-none-eabi-nm', 'arm-none-eabi-objdump'
+    flash_start, flash_end = 0x10000000, 0x20000000
+    for opt, value in opts:
+        if opt == '--nm':
+            nm = value
+        elif opt == '--objdump':
+            objdump = value
+        elif opt == '--flash':
+            flash_start, flash_end = (int(x, 0) for x in value.split(':'))
+    elf = args[0]
+
+    functions = symbols(nm, elf)
+    # Callers, for the call chain of the errors
+    callers = {name: None for name in functions if ROOTS.match(name)}
+    if not callers:
+        print('%s: no bus loop found' % elf, file=sys.stderr)
+        return 1
+    pending = list(callers)
+    errors = []
+    while pending:
+        name = pending.pop()
+        address, size = functions[name]
+        if flash_start <= address < flash_end:
+            errors.append(chain(callers, name))
+            continue
+        for target, target_name in branches(objdump, elf, address, size):
+            veneer = VENEER.match(target_name)
+            for callee in [target_name] + ([veneer.group(1)] if veneer else []):
+                if callee in functions and callee not in callers:
+                    callers[callee] = name
+                    pending.append(callee)
+            if flash_start <= target < flash_end and target_name not in functions:
+                errors.append(['0x%x <%s>' % (target, target_name)] + chain(callers, name))
+    for error in errors:
+        print('%s: core1 calls into flash: %s' % (elf, ' <- '.join(error)), file=sys.stderr)
+    if not errors:
+        print('%s: %d functions reachable from the bus loops, all in RAM' % (elf, len(callers)))
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# Flash directory of the cartridge (sector at 0x000ff000): lists the roms with their save area, and
+# allocates flash for new ones, packed in the free space after the first 1 MiB (firmware), around the roms still
+# programmed in fixed slots.
+
+import os, struct, sys, getopt
+
+import packrom
+
+DIR_MAGIC = b"pico-gb-dir     "
+DIR_SIZE = 4096
+MAX_ENTRIES = 14        # As listed by the launcher
+ENTRY = struct.Struct("<IIII")     # offset, length, save offset, save length
+SECTOR = 4096
+RTC_PAGE = 256
+FLASH_START = 0x100000
+FLASH_SIZE = 16 * 1024 * 1024
+SLOT_MAGIC = b"pico-gb-rom     "
+SLOT_SIZE = 0x100000
+SLOTS = range(1, 16)    # As searched by the firmware without a directory
+SLOT_HEADER = 32
+# Dumped from the start of each slot by loadrom.sh: slot header and cartridge header
+SLOT_DUMP = SLOT_HEADER + packrom.HEADER_END
+
+
+def align(n):
+    return (n + SECTOR - 1) // SECTOR * SECTOR
+
+
+def read_dir(path):
+    data = b""
+    if os.path.exists(path):
+        with open(path, "rb") as f:
+            data = f.read(DIR_SIZE)
+    if len(data) < 32 or data[:16] != DIR_MAGIC:
+        return []
+    count = struct.unpack_from("<I", data, 16)[0]
+    if count > MAX_ENTRIES:
+        return []
+    return [ENTRY.unpack_from(data, 32 + i * ENTRY.size) for i in range(count)]
+
+
+def write_dir(path, entries):
+    data = bytearray(DIR_MAGIC)
+    data += struct.pack("<IIII", len(entries), 0xffffffff, 0xffffffff, 0xffffffff)
+    for entry in entries:
+        data += ENTRY.pack(*entry)
+    data += b"\xff" * (DIR_SIZE - len(data))
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def save_length(rom):
+    # Same as init_rom, with a page for the clock of MBC3 carts
+    length = 0
+    if rom[0x147] in (0x02, 0x03, 0x10, 0x12, 0x13, 0x1a, 0x1b, 0x1d, 0x1e):
+        length = {2: 8, 3: 32, 4: 128, 5: 64}.get(rom[0x149], 0) * 1024
+    if rom[0x147] in (0x05, 0x06):
+        length = 512
+    if rom[0x147] in (0x0f, 0x10):
+        length += RTC_PAGE
+    return length
+
+
+def read_slots(path):
+    # (offset, end) of the fixed slots holding a rom, from the dumps of their start
+    used = []
+    with open(path, "rb") as f:
+        data = f.read()
+    for i, index in enumerate(SLOTS):
+        dump = data[i * SLOT_DUMP:(i + 1) * SLOT_DUMP]
+        if len(dump) < SLOT_DUMP or dump[:16] != SLOT_MAGIC:
+            continue
+        size, slot_format = struct.unpack_from("<IB", dump, 16)
+        stored = struct.unpack_from("<I", dump, 24)[0] if slot_format == 0x01 else size
+        if stored > FLASH_SIZE:
+            # Not a header written by packrom.py or loadrom.sh: keep the slot
+            stored = 0
+        # As ram_persistent_flash_addr: roms larger than a slot span the next ones, their save at the end
+        length = SLOT_HEADER + stored + align(save_length(dump[SLOT_HEADER:]))
+        used.append((index * SLOT_SIZE, (index + (length + SLOT_SIZE - 1) // SLOT_SIZE) * SLOT_SIZE))
+    return used
+
+
+def allocate(entries, length, flash_size, used=()):
+    # First fit, sector aligned
+    used = list(used)
+    for offset, rom_length, save_offset, save_len in entries:
+        used.append((offset, align(offset + rom_length)))
+        if save_len > 0:
+            used.append((save_offset, save_offset + align(save_len)))
+    start = FLASH_START
+    for begin, end in sorted(used):
+        if begin - start >= length:
+            return start
+        start = max(start, end)
+    if flash_size - start >= length:
+        return start
+    return None
+
+
+def usage():
+    print("flashdir.py list <directory>")
+    print("flashdir.py add [-z] [-f flash size] [-s slot headers] <directory> <rom file> <slot image>")
+    print("flashdir.py remove <directory> <index>")
+    print("  add writes the slot image to program and prints its flash offset, remove frees the flash of a rom")
+    print("  -s  the first %d bytes of slots %d to %d, one after the other: roms found there are not written over"
+          % (SLOT_DUMP, SLOTS[0], SLOTS[-1]))
+    sys.exit(2)
+
+
+def main(argv):
+    if len(argv) < 1:
+        usage()
+    command = argv[0]
+    packed = False
+    flash_size = FLASH_SIZE
+    slots = []
+    try:
+        opts, args = getopt.getopt(argv[1:], "hzf:s:")
+    except getopt.GetoptError:
+        usage()
+    for opt, arg in opts:
+        if opt == "-h":
+            usage()
+        elif opt == "-z":
+            packed = True
+        elif opt == "-f":
+            flash_size = int(arg, 0)
+        elif opt == "-s":
+            slots = read_slots(arg)
+            for begin, end in slots:
+                print("Slot #%d in use, %d MiB kept" % (begin // SLOT_SIZE, (end - begin) // SLOT_SIZE))
+
+    if command == "list" and len(args) == 1:
+        for i, (offset, length, save_offset, save_len) in enumerate(read_dir(args[0])):
+            save = "0x%06x (%d KiB)" % (save_offset, save_len // 1024) if save_len > 0 else "none"
+            print("#%d: 0x%06x, %d KiB, save %s" % (i, offset, length // 1024, save))
+    elif command == "add" and len(args) == 3:
+        entries = read_dir(args[0])
+        if len(entries) >= MAX_ENTRIES:
+            print("Directory full (%d roms)" % MAX_ENTRIES)
+            sys.exit(1)
+        with open(args[1], "rb") as f:
+            rom = f.read()
+        image = packrom.slot_image(rom, packed)
+        save_len = save_length(rom)
+        offset = allocate(entries, align(len(image)) + align(save_len), flash_size, slots)
+        if offset is None:
+            print("Not enough free flash for %d bytes" % (len(image) + save_len))
+            sys.exit(1)
+        save_offset = align(offset + len(image)) if save_len > 0 else 0
+        entries.append((offset, len(image), save_offset, save_len))
+        with open(args[2], "wb") as f:
+            f.write(image)
+        write_dir(args[0], entries)
+        print("0x%06x" % offset)
+    elif command == "remove" and len(args) == 2:
+        entries = read_dir(args[0])
+        del entries[int(args[1])]
+        write_dir(args[0], entries)
+    else:
+        usage()
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -2,6 +2,40 @@
 
 OPENOCD=openocd
 
+# Flash directory (tools/flashdir.py): list, add a rom (-z to pack it) or remove one
+if [ "$1" = "-l" ] || [ "$1" = "-a" ] || [ "$1" = "-r" ]; then
+    tools=$(dirname "$0")
+    dir_addr=0x100FF000
+
+    $OPENOCD -f interface/jlink.cfg -c "transport select swd" -c "adapter speed 6000" -f target/rp2350.cfg -c "init; halt; dump_image /tmp/dir.bin $dir_addr 4096; resume; exit" || exit 1
+
+    if [ "$1" = "-l" ]; then
+        python3 "$tools/flashdir.py" list /tmp/dir.bin
+        exit 0
+    elif [ "$1" = "-a" ]; then
+        # Start of the fixed slots (slot header and cartridge header), not to allocate over their roms
+        dumps=""
+        for i in {1..15}; do
+            dumps="$dumps dump_image /tmp/slot$i.bin $(printf "0x%X" $((i * 0x100000 + 0x10000000))) 368;"
+        done
+        $OPENOCD -f interface/jlink.cfg -c "transport select swd" -c "adapter speed 6000" -f target/rp2350.cfg -c "init; halt;$dumps resume; exit" || exit 1
+        cat /tmp/slot{1..15}.bin > /tmp/slots.bin
+
+        output=$(python3 "$tools/flashdir.py" add $3 -s /tmp/slots.bin /tmp/dir.bin "$2" /tmp/rom.bin) || { echo "$output"; exit 1; }
+        echo "$output" | head -n -1
+        offset=$(echo "$output" | tail -1)
+        addr=$(printf "0x%X" $((offset + 0x10000000)))
+        echo "programming rom $2 at address $addr"
+        $OPENOCD -f interface/jlink.cfg -c "transport select swd" -c "adapter speed 6000" -f target/rp2350.cfg -c "program /tmp/rom.bin verify exit $addr" || exit 1
+    else
+        python3 "$tools/flashdir.py" remove /tmp/dir.bin $2 || exit 1
+    fi
+
+    echo "programming directory"
+    $OPENOCD -f interface/jlink.cfg -c "transport select swd" -c "adapter speed 6000" -f target/rp2350.cfg -c "program /tmp/dir.bin verify reset exit $dir_addr"
+    exit 0
+fi
+
 # List slots
 if [ "$#" -eq 0 ]; then
     for i in {1..14}; do
@@ -51,23 +85,29 @@ fi
 rom=$1
 index=$2    # Between 1 and 14
 
-# Magic bytes
-echo -en 'pico-gb-rom     ' > /tmp/rom.bin
-
-# Rom size
-size=$(stat -c "%s" "$rom")
-echo $size
-size=$(printf "0x%X" $((size)))
-echo $size
-printf "0: %.4x" $((size & 0xffff)) | xxd -r -g0 | dd conv=swab >> /tmp/rom.bin
-printf "0: %.4x" $((size >> 16)) | xxd -r -g0 | dd conv=swab >> /tmp/rom.bin
-
-# Padding
-echo -en '\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff' >> /tmp/rom.bin
-
-# Checksum
-cksum -a bsd --raw "$rom" | dd conv=swab >> /tmp/rom.bin
-cat "$rom" >> /tmp/rom.bin
+if [ "$3" != "-b" ]; then
+    # CRC32 slot, packed with -z
+    python3 "$(dirname "$0")/packrom.py" $3 "$rom" /tmp/rom.bin || exit 1
+else
+    # BSD checksum slot, for firmwares without CRC32 support
+    # Magic bytes
+    echo -en 'pico-gb-rom     ' > /tmp/rom.bin
+
+    # Rom size
+    size=$(stat -c "%s" "$rom")
+    echo $size
+    size=$(printf "0x%X" $((size)))
+    echo $size
+    printf "0: %.4x" $((size & 0xffff)) | xxd -r -g0 | dd conv=swab >> /tmp/rom.bin
+    printf "0: %.4x" $((size >> 16)) | xxd -r -g0 | dd conv=swab >> /tmp/rom.bin
+
+    # Padding
+    echo -en '\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff' >> /tmp/rom.bin
+
+    # Checksum
+    cksum -a bsd --raw "$rom" | dd conv=swab >> /tmp/rom.bin
+    cat "$rom" >> /tmp/rom.bin
+fi
 
 # Destination address
 addr=$(printf "0x%X" $((index * 0x100000 + 0x10000000)))
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# Writes the flash image of a rom slot (as programmed by loadrom.sh), optionally packed:
+# the cartridge header (0x0000-0x014f) as is, then the rest of the rom as an LZ4 block.
+# The stored data is checked with a CRC32, or the 16-bit BSD sum of the original loadrom.sh.
+
+import struct, sys, getopt, zlib
+
+HEADER_END = 0x150
+MIN_MATCH = 4
+MAX_OFFSET = 0xffff
+# LZ4 block end: the last match starts 12 bytes before the end at the latest, the last 5 bytes are literals
+MATCH_LIMIT = 12
+LAST_LITERALS = 5
+
+
+def bsd_checksum(data):
+    checksum = 0
+    for ch in data:
+        checksum = (checksum >> 1) + ((checksum & 1) << 15)
+        checksum = (checksum + ch) & 0xffff
+    return checksum
+
+
+def length_bytes(n):
+    # Extension of a 15 nibble
+    out = bytearray()
+    n -= 15
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+    return out
+
+
+def sequence(literals, match_length, offset):
+    token_literals = min(len(literals), 15)
+    token_match = 0 if match_length is None else min(match_length - MIN_MATCH, 15)
+    out = bytearray([(token_literals << 4) | token_match])
+    if len(literals) >= 15:
+        out += length_bytes(len(literals))
+    out += literals
+    if match_length is not None:
+        out += struct.pack("<H", offset)
+        if match_length - MIN_MATCH >= 15:
+            out += length_bytes(match_length - MIN_MATCH)
+    return out
+
+
+def pack(rom):
+    # Greedy, one candidate per 4-byte hash; matches may reach into the header
+    out = bytearray(rom[:HEADER_END])
+    table = {}
+    for i in range(0, HEADER_END - MIN_MATCH + 1):
+        table[rom[i:i + MIN_MATCH]] = i
+    anchor = HEADER_END
+    pos = HEADER_END
+    end = len(rom)
+    while pos + MATCH_LIMIT <= end:
+        key = rom[pos:pos + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = pos
+        if candidate is None or pos - candidate > MAX_OFFSET:
+            pos += 1
+            continue
+        length = MIN_MATCH
+        while pos + length < end - LAST_LITERALS and rom[candidate + length] == rom[pos + length]:
+            length += 1
+        out += sequence(rom[anchor:pos], length, pos - candidate)
+        for i in range(pos + 1, min(pos + length, end - MIN_MATCH)):
+            table[rom[i:i + MIN_MATCH]] = i
+        pos += length
+        anchor = pos
+    if anchor < end:
+        out += sequence(rom[anchor:end], None, 0)
+    return bytes(out)
+
+
+def slot_image(rom, packed, crc=True):
+    header = bytearray(b"pico-gb-rom     ")
+    header += struct.pack("<I", len(rom))
+    if packed and len(rom) > HEADER_END:
+        data = pack(rom)
+        header += bytes([0x01, 0x01 if crc else 0xff, 0xff, 0xff])
+        header += struct.pack("<I", len(data))
+        print("Packed %d bytes to %d bytes (%.1f%%)" % (len(rom), len(data), 100.0 * len(data) / len(rom)))
+    else:
+        data = rom
+        header += bytes([0xff, 0x01 if crc else 0xff]) + b"\xff" * 6
+    if crc:
+        header += struct.pack("<I", zlib.crc32(data))
+    else:
+        header += b"\xff\xff" + struct.pack("<H", bsd_checksum(data))
+    return bytes(header + data)
+
+
+def usage():
+    print("packrom.py [-z] [-b] <rom file> <slot image>")
+    print("  -z  pack the rom")
+    print("  -b  BSD checksum instead of CRC32, for firmwares without CRC32 support")
+    sys.exit(2)
+
+
+def main(argv):
+    packed = False
+    crc = True
+    try:
+        opts, args = getopt.getopt(argv, "hzb")
+    except getopt.GetoptError:
+        usage()
+    for opt, arg in opts:
+        if opt == "-h":
+            usage()
+        elif opt == "-z":
+            packed = True
+        elif opt == "-b":
+            crc = False
+    if len(args) != 2:
+        usage()
+
+    with open(args[0], "rb") as f:
+        rom = f.read()
+
+    with open(args[1], "wb") as f:
+        f.write(slot_image(rom, packed, crc))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])